@@ -1,9 +1,25 @@
 #include "devices/block.h"
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Largest number of sectors that separate requests may be merged
+   into.  Merged requests go through a bounce buffer this big. */
+#define MERGE_MAX 64
+
+/* Timer ticks that a read or a write may wait in a queue before
+   it is dispatched ahead of the elevator.  Reads get a shorter
+   deadline because a thread is usually waiting for them. */
+#define READ_DEADLINE (TIMER_FREQ / 2)
+#define WRITE_DEADLINE (TIMER_FREQ * 5)
 
 /* A block device. */
 struct block
@@ -17,8 +33,16 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_stats stats;           /* I/O statistics. */
+
+    /* Request queue, unused if OPS->map is non-null. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_nonempty;    /* Signaled when a request arrives. */
+    struct list queue;                  /* Pending requests by sector. */
+    struct list fifo;                   /* Pending requests by arrival. */
+    block_sector_t next_sector;         /* Sector the elevator is at. */
+    uint8_t *bounce;                    /* Buffer for merged requests. */
+    struct thread *thread;              /* Serves the queue, once running. */
   };
 
 /* List of all block devices. */
@@ -28,6 +52,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func queue_thread NO_RETURN;
+static void count_submit (struct block *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -99,18 +125,103 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  if (cnt > block->size || sector > block->size - cnt)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu", "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt, block->size);
+}
+
+/* Initializes R as a request to read (or, if WRITE is true, to
+   write) CNT sectors starting at SECTOR into (or from) BUFFER,
+   which must be big enough for CNT * BLOCK_SECTOR_SIZE bytes.
+   A write does not modify BUFFER.  When the request completes,
+   it is passed to DONE, if DONE is non-null; otherwise, whoever
+   submitted it must block_wait() for it. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, void *buffer, block_sector_t cnt,
+                    block_done_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  r->write = write;
+  r->sector = sector;
+  r->buffer = buffer;
+  r->cnt = cnt;
+  r->done = done;
+  r->aux = aux;
+  sema_init (&r->finished, 0);
+}
+
+/* Returns true if A and B touch any of the same sectors. */
+static bool
+overlaps (const struct block_request *a, const struct block_request *b)
+{
+  return a->sector < b->sector + b->cnt && b->sector < a->sector + a->cnt;
+}
+
+/* Returns true if A's first sector is less than B's. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Queues R on BLOCK and returns without waiting for it.  The
+   block layer owns R, which must not be modified or freed, until
+   it completes.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_submit (struct block *block, struct block_request *r)
 {
-  if (sector >= block->size)
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  /* Find the device that really holds the sectors. */
+  r->origin = block;
+  while (block->ops->map != NULL)
     {
-      /* We do not use ASSERT because we want to panic here
-         regardless of whether NDEBUG is defined. */
-      PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+      block = block->ops->map (block->aux, &r->sector);
+      check_sectors (block, r->sector, r->cnt);
     }
+
+  r->start = timer_usecs ();
+  count_submit (r->origin);
+  if (block != r->origin)
+    count_submit (block);
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  r->priority = thread_get_priority ();
+  lock_acquire (&block->queue_lock);
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  list_push_back (&block->fifo, &r->fifo_elem);
+  /* Lift the queue thread to R's priority right away, rather than
+     when it next picks a batch, so that R is not stuck behind
+     threads of middling priority in the meantime. */
+  if (block->thread != NULL && !thread_mlfqs
+      && block->thread->priority < r->priority)
+    thread_change_priority (block->thread, r->priority);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for R, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->done == NULL);
+  sema_down (&r->finished);
 }
 
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
@@ -120,9 +231,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +242,293 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer all of the sectors
+   with a single request. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  struct block_request r;
+
+  block_request_init (&r, false, sector, buffer, cnt, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  struct block_request r;
+
+  block_request_init (&r, true, sector, (void *) buffer, cnt, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Statistics. */
+
+/* Counts a newly submitted request against BLOCK. */
+static void
+count_submit (struct block *block)
+{
+  struct block_stats *s = &block->stats;
+  enum intr_level old_level = intr_disable ();
+
+  s->depth++;
+  if (s->depth > s->max_depth)
+    s->max_depth = s->depth;
+  s->depth_sum += s->depth;
+  intr_set_level (old_level);
+}
+
+/* Counts R, which has just completed after LATENCY microseconds,
+   against BLOCK.  MERGED is true if R's transfer was merged into
+   another request's. */
+static void
+count_complete (struct block *block, const struct block_request *r,
+                int64_t latency, bool merged)
+{
+  struct block_stats *s = &block->stats;
+  int bucket = 0;
+  enum intr_level old_level;
+
+  while (bucket < BLOCK_LATENCY_BUCKETS - 1 && latency >> (bucket + 1) > 0)
+    bucket++;
+
+  old_level = intr_disable ();
+  s->depth--;
+  s->sectors[r->write] += r->cnt;
+  s->requests[r->write]++;
+  s->latency_us[r->write] += latency;
+  s->latency_hist[r->write][bucket]++;
+  if (merged)
+    s->merged++;
+  intr_set_level (old_level);
+}
+
+/* Copies BLOCK's statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Request dispatching. */
+
+/* Returns the oldest request in BLOCK's queue that arrived before
+   R and touches any of R's sectors, or a null pointer if there is
+   none.  BLOCK's queue_lock must be held. */
+static struct block_request *
+older_overlap (struct block *block, struct block_request *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->fifo); e != &r->fifo_elem; e = list_next (e))
+    {
+      struct block_request *o = list_entry (e, struct block_request,
+                                            fifo_elem);
+      if (overlaps (o, r))
+        return o;
+    }
+  return NULL;
+}
+
+/* Chooses the next request to dispatch from BLOCK's nonempty
+   queue: the oldest request if its deadline has passed, otherwise
+   the first at or after the elevator's position, wrapping around
+   to the lowest sector (C-LOOK).  BLOCK's queue_lock must be
+   held. */
+static struct block_request *
+pick_request (struct block *block)
+{
+  struct block_request *r, *o;
+  struct list_elem *e;
+
+  r = list_entry (list_front (&block->fifo), struct block_request, fifo_elem);
+  if (timer_ticks () < r->deadline)
+    {
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        if (list_entry (e, struct block_request, elem)->sector
+            >= block->next_sector)
+          break;
+      if (e == list_end (&block->queue))
+        e = list_begin (&block->queue);
+      r = list_entry (e, struct block_request, elem);
+    }
+
+  while ((o = older_overlap (block, r)) != NULL)
+    r = o;
+  return r;
+}
+
+/* Removes the next request from BLOCK's nonempty queue, along
+   with the requests that directly follow it on disk in the same
+   direction, up to MERGE_MAX sectors in all, and moves them to
+   BATCH in sector order.  Returns the number of sectors in the
+   batch.  BLOCK's queue_lock must be held. */
+static block_sector_t
+take_batch (struct block *block, struct list *batch)
+{
+  struct block_request *first = pick_request (block);
+  block_sector_t cnt = first->cnt;
+  struct list_elem *e = list_next (&first->elem);
+
+  list_remove (&first->elem);
+  list_remove (&first->fifo_elem);
+  list_push_back (batch, &first->elem);
+
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+
+      if (r->sector != first->sector + cnt || r->write != first->write
+          || cnt + r->cnt > MERGE_MAX || older_overlap (block, r) != NULL)
+        break;
+      e = list_next (e);
+      list_remove (&r->elem);
+      list_remove (&r->fifo_elem);
+      list_push_back (batch, &r->elem);
+      cnt += r->cnt;
+    }
+
+  block->next_sector = first->sector + cnt;
+  return cnt;
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR
+   between the disk and BUFFER. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          void *buffer, block_sector_t cnt)
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, sector, buffer, cnt);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        uint8_t *sector_buffer = (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE;
+
+        if (write)
+          ops->write (block->aux, sector + i, sector_buffer);
+        else
+          ops->read (block->aux, sector + i, sector_buffer);
+      }
+}
+
+/* Returns the highest submitter priority among the requests in
+   LIST, linked by their elem members, or PRI_MIN if it is empty. */
+static int
+max_priority (struct list *list)
+{
+  struct list_elem *e;
+  int priority = PRI_MIN;
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->priority > priority)
+        priority = r->priority;
+    }
+  return priority;
+}
+
+/* Serves BLOCK's request queue.  The thread runs at the priority
+   of the highest priority thread with a request in the queue, so
+   that it neither preempts threads more important than any it
+   serves nor is held off by them. */
+static void
+queue_thread (void *block_)
+{
+  struct block *block = block_;
+
+  lock_acquire (&block->queue_lock);
+  block->thread = thread_current ();
+  lock_release (&block->queue_lock);
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *first;
+      block_sector_t cnt;
+      int priority, queued;
+
+      list_init (&batch);
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      cnt = take_batch (block, &batch);
+      priority = max_priority (&batch);
+      queued = max_priority (&block->queue);
+      lock_release (&block->queue_lock);
+
+      thread_set_priority (queued > priority ? queued : priority);
+
+      first = list_entry (list_front (&batch), struct block_request, elem);
+      if (list_size (&batch) == 1)
+        transfer (block, first->write, first->sector, first->buffer, cnt);
+      else
+        {
+          /* Gather writes into the bounce buffer, or scatter reads
+             out of it. */
+          struct list_elem *e;
+          uint8_t *p;
+
+          if (first->write)
+            for (e = list_begin (&batch), p = block->bounce;
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r;
+                r = list_entry (e, struct block_request, elem);
+                memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          transfer (block, first->write, first->sector, block->bounce, cnt);
+          if (!first->write)
+            for (e = list_begin (&batch), p = block->bounce;
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r;
+                r = list_entry (e, struct block_request, elem);
+                memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* A request may be freed as soon as it completes, so move
+         past it first. */
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          int64_t latency = timer_usecs () - r->start;
+
+          count_complete (r->origin, r, latency, r != first);
+          if (r->origin != block)
+            count_complete (block, r, latency, r != first);
+          if (r->done != NULL)
+            r->done (r);
+          else
+            sema_up (&r->finished);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,21 +552,73 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints BLOCK's statistics. */
+static void
+print_block_stats (struct block *block)
+{
+  static const char *dir_names[2] = {"read", "write"};
+  struct block_stats s;
+  int dir, i;
+
+  block_get_stats (block, &s);
+  printf ("%s (%s): %llu reads, %llu writes\n",
+          block->name, block_type_name (block->type),
+          s.sectors[0], s.sectors[1]);
+  if (s.requests[0] + s.requests[1] == 0)
+    return;
+
+  printf ("  %llu requests, %llu merged, queue depth avg %llu.%02llu "
+          "max %u\n", s.requests[0] + s.requests[1], s.merged,
+          s.depth_sum / (s.requests[0] + s.requests[1] + s.depth),
+          s.depth_sum * 100 / (s.requests[0] + s.requests[1] + s.depth) % 100,
+          s.max_depth);
+  for (dir = 0; dir < 2; dir++)
+    if (s.requests[dir] > 0)
+      {
+        printf ("  %s: %llu requests, %llu bytes, avg %llu us; us:",
+                dir_names[dir], s.requests[dir],
+                s.sectors[dir] * BLOCK_SECTOR_SIZE,
+                s.latency_us[dir] / s.requests[dir]);
+        for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+          if (s.latency_hist[dir][i] > 0)
+            printf (" %s%llu:%llu", i == BLOCK_LATENCY_BUCKETS - 1 ? ">=" : "",
+                    1ULL << i, s.latency_hist[dir][i]);
+        printf ("\n");
+      }
+}
+
+/* Returns true if BLOCK is used for a Pintos role. */
+static bool
+has_role (struct block *block)
+{
+  int i;
+
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] == block)
+      return true;
+  return false;
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, then for each disk that has no role itself but whose
+   request queue served some. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] != NULL)
+      print_block_stats (block_by_role[i]);
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->ops->map == NULL && !has_role (block)
+          && block->stats.requests[0] + block->stats.requests[1] > 0)
+        print_block_stats (block);
     }
 }
 
@@ -198,8 +642,25 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+
+  if (ops->map == NULL)
+    {
+      char thread_name[sizeof block->name + 3];
+
+      lock_init (&block->queue_lock);
+      cond_init (&block->queue_nonempty);
+      list_init (&block->queue);
+      list_init (&block->fifo);
+      block->next_sector = 0;
+      block->thread = NULL;
+      block->bounce = palloc_get_multiple (PAL_ASSERT,
+                                           DIV_ROUND_UP (MERGE_MAX
+                                                         * BLOCK_SECTOR_SIZE,
+                                                         PGSIZE));
+      snprintf (thread_name, sizeof thread_name, "%s-io", block->name);
+      thread_create (thread_name, PRI_DEFAULT, queue_thread, block);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +55,75 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
-/* Statistics. */
+/* Asynchronous requests.
+
+   Each block device that is not a view of another device has a
+   queue of pending requests, served one batch at a time by a
+   kernel thread in elevator order.  Adjacent requests in the
+   same direction are merged into one driver call.  A request
+   that has waited too long goes first, and no request passes an
+   older one that touches any of the same sectors. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    /* Set by block_request_init(). */
+    bool write;                 /* Write, as opposed to read? */
+    block_sector_t sector;      /* First sector. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_sector_t cnt;         /* Number of sectors. */
+    block_done_func *done;      /* Completion callback, or null. */
+    void *aux;                  /* For use by DONE. */
+
+    /* Owned by block.c. */
+    struct list_elem elem;      /* Element in queue by sector, or batch. */
+    struct list_elem fifo_elem; /* Element in queue by arrival. */
+    struct block *origin;       /* Device it was submitted to. */
+    int64_t start;              /* timer_usecs() at submission. */
+    int64_t deadline;           /* Dispatch by this timer tick. */
+    int priority;               /* Submitting thread's priority. */
+    struct semaphore finished;  /* Up'd on completion if DONE is null. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, void *buffer, block_sector_t cnt,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
+/* Statistics.
+
+   Arrays indexed by direction hold reads at 0 and writes at 1.
+   Each request is counted against the device it was submitted
+   to and, if different, the device whose queue served it. */
+#define BLOCK_LATENCY_BUCKETS 20
+
+struct block_stats
+  {
+    unsigned long long sectors[2];      /* Sectors transferred. */
+    unsigned long long requests[2];     /* Requests completed. */
+    unsigned long long merged;          /* Requests merged into another's
+                                           driver call. */
+    unsigned depth;                     /* Requests now in flight. */
+    unsigned max_depth;                 /* Most requests ever in flight. */
+    unsigned long long depth_sum;       /* Sum of DEPTH at each submit. */
+    unsigned long long latency_us[2];   /* Total submit-to-completion time. */
+
+    /* Requests by latency: bucket I counts latencies of at least
+       2**I microseconds (bucket 0 also those under 1 us), and the
+       last bucket everything longer. */
+    unsigned long long latency_hist[2][BLOCK_LATENCY_BUCKETS];
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,6 +132,21 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in one request.  May be
+       null, in which case the block layer falls back to one
+       read or write call per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
+
+    /* For a device that is a view of part of another device,
+       returns the other device and translates *SECTOR into its
+       sector numbering.  Requests are then queued on the other
+       device, and the operations above are never called.  Null
+       for other devices. */
+    struct block *(*map) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
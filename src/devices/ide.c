@@ -3,15 +3,21 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <round.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Transfers use
+   bus master DMA [BMIDE] when the controller is a PCI IDE
+   controller that supports it, such as the PIIX that QEMU
+   emulates, and READ/WRITE MULTIPLE in PIO mode otherwise. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +40,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +56,49 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* IDENTIFY DEVICE words that we use. */
+#define ID_MULTIPLE_MAX 47      /* Bits 7:0: max sectors per DRQ block. */
+#define ID_CAPABILITIES 49      /* Bit 8: DMA supported. */
+#define ID_CAP_DMA 0x0100
+
+/* PCI class, subclass and programming interface bits of an IDE
+   controller. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define IDE_PROGIF_NATIVE 0x05  /* Either channel in PCI native mode. */
+#define IDE_PROGIF_MASTER 0x80  /* Bus master capable. */
+
+/* Bus master IDE port addresses, one set per channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master command register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* 0=memory to disk, 1=disk to memory. */
+
+/* Bus master status register bits.  ERR and INTR are cleared by
+   writing 1 to them. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Device raised its interrupt. */
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA buffer.  A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, where 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last region. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_REGION_SIZE 65536   /* Largest region. */
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +107,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per READ/WRITE MULTIPLE block,
+                                   or 0 to transfer one sector at a time. */
+    bool use_dma;               /* Transfer with bus master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +119,7 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master I/O port, or 0 if none. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -79,16 +133,31 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Maximum number of sectors in one READ or WRITE command.  A
+   sector count register value of 0 means 256 sectors. */
+#define IDE_MAX_SECTORS 256
+
+/* One PRD table per channel, big enough for IDE_MAX_SECTORS
+   sectors at any alignment.  The alignment keeps each table
+   within a 64 kB region, as the controller requires. */
+#define PRD_CNT 4
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static uint16_t find_bus_master (void);
+static bool set_multiple_mode (struct ata_disk *, int sectors);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, block_sector_t cnt);
+static void output_sectors (struct channel *, const void *,
+                            block_sector_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +170,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,6 +193,7 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
@@ -136,6 +207,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -157,6 +230,33 @@ ide_init (void)
 
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller whose legacy channels can do bus
+   master DMA, and enables bus mastering on it.  Returns the I/O
+   port of its bus master registers, or 0 if there is no such
+   controller. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_func f;
+  uint32_t progif, bar;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &f))
+    return 0;
+  progif = (pci_read (f, PCI_REG_CLASS) >> 8) & 0xff;
+  if ((progif & IDE_PROGIF_NATIVE) != 0 || (progif & IDE_PROGIF_MASTER) == 0)
+    return 0;
+
+  /* The bus master registers are I/O ports at BAR 4. */
+  bar = pci_read (f, PCI_REG_BAR (4));
+  if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+    return 0;
+
+  pci_write (f, PCI_REG_COMMAND,
+             pci_read (f, PCI_REG_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  printf ("ide: bus master DMA at port %#x\n", bar & 0xfffc);
+  return bar & 0xfffc;
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -261,6 +361,7 @@ identify_ata_device (struct ata_disk *d)
 {
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
+  const uint16_t *id_words = (const uint16_t *) id;
   block_sector_t capacity;
   char *model, *serial;
   char extra_info[128];
@@ -279,15 +380,24 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
+
+  /* Transfer whole blocks per interrupt in PIO mode, and use DMA
+     if both the disk and the channel can. */
+  d->multiple = id_words[ID_MULTIPLE_MAX] & 0xff;
+  if (d->multiple > 0 && !set_multiple_mode (d, d->multiple))
+    d->multiple = 0;
+  d->use_dma = c->bm_base != 0 && (id_words[ID_CAPABILITIES] & ID_CAP_DMA);
+
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\", %s", model, serial,
+            d->use_dma ? "DMA" : d->multiple > 0 ? "PIO multiple" : "PIO");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -337,63 +447,241 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Sends SET MULTIPLE MODE to disk D so that READ MULTIPLE and
+   WRITE MULTIPLE transfer SECTORS sectors per interrupt.  Returns
+   true if successful, false if the disk refused. */
+static bool
+set_multiple_mode (struct ata_disk *d, int sectors)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  return (inb (reg_alt_status (c)) & STA_ERR) == 0;
+}
+
+/* Fills in channel C's PRD table to describe the CNT sectors at
+   BUFFER.  Returns false if BUFFER cannot be used for DMA. */
+static bool
+build_prd_table (struct channel *c, const void *buffer, block_sector_t cnt)
+{
+  struct prd *prd = prd_tables[c - channels];
+  uintptr_t addr, end;
+  size_t i;
+
+  /* Kernel virtual memory maps physical memory one-to-one, so a
+     kernel buffer is physically contiguous. */
+  if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 4 != 0)
+    return false;
+
+  addr = vtop (buffer);
+  end = addr + cnt * BLOCK_SECTOR_SIZE;
+  for (i = 0; addr < end; i++)
+    {
+      uintptr_t next = ROUND_DOWN (addr, PRD_REGION_SIZE) + PRD_REGION_SIZE;
+      if (next > end)
+        next = end;
+
+      ASSERT (i < PRD_CNT);
+      prd[i].addr = addr;
+      prd[i].size = next - addr;
+      prd[i].flags = 0;
+      addr = next;
+    }
+  prd[i - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER with bus master DMA, reading from the disk if READ is
+   true and writing to it otherwise.  Returns true if successful.
+   Returns false, having transferred nothing, if DMA cannot be
+   used for BUFFER; or if the transfer failed, in which case DMA
+   is turned off for D.  D's channel must be locked. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const void *buffer, block_sector_t cnt, bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_CMD_READ : 0;
+  uint8_t bm_status;
+
+  if (!d->use_dma || !build_prd_table (c, buffer, cnt))
+    return false;
+
+  outl (reg_bm_prdt (c), vtop (prd_tables[c - channels]));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  if ((bm_status & BM_STA_ERR) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu", "
+              "falling back to PIO\n", d->name, sec_no);
+      d->use_dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER
+   in PIO mode, taking one interrupt per READ MULTIPLE block, or
+   per sector if D does not support READ MULTIPLE.  D's channel
+   must be locked. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, uint8_t *buffer,
+          block_sector_t cnt)
+{
+  struct channel *c = d->channel;
+  block_sector_t block = d->multiple > 0 ? d->multiple : 1;
+  block_sector_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, (d->multiple > 0
+                         ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
+  for (i = 0; i < cnt; i += block)
+    {
+      block_sector_t n = cnt - i < block ? cnt - i : block;
+
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      input_sectors (c, buffer + i * BLOCK_SECTOR_SIZE, n);
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER in
+   PIO mode, as pio_read() does for reads.  D's channel must be
+   locked. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no,
+           const uint8_t *buffer, block_sector_t cnt)
+{
+  struct channel *c = d->channel;
+  block_sector_t block = d->multiple > 0 ? d->multiple : 1;
+  block_sector_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, (d->multiple > 0
+                         ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+  for (i = 0; i < cnt; i += block)
+    {
+      block_sector_t n = cnt - i < block ? cnt - i : block;
+
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      output_sectors (c, buffer + i * BLOCK_SECTOR_SIZE, n);
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Issues one DMA or PIO command per IDE_MAX_SECTORS
+   sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer_,
+                   block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+      if (!dma_transfer (d, sec_no, buffer, chunk, true))
+        pio_read (d, sec_no, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sec_no += chunk;
+      cnt -= chunk;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving all of the
+   data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer_,
+                    block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      block_sector_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+      if (!dma_transfer (d, sec_no, buffer, chunk, false))
+        pio_write (d, sec_no, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sec_no += chunk;
+      cnt -= chunk;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, buffer, 1);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= IDE_MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == IDE_MAX_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,20 +702,21 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, block_sector_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes SECTORS to channel C's data register in PIO mode.
+   SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, block_sector_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -0,0 +1,86 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   with configuration mechanism #1, which every PC chipset that
+   Pintos runs on (and QEMU and Bochs) implements.  See [PCI] for
+   details.  It does no resource assignment: it relies on the BIOS
+   to have programmed the base address registers. */
+
+/* I/O port addresses. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects configuration register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes selected register. */
+
+/* Bit in PCI_CONFIG_ADDR that enables configuration cycles. */
+#define PCI_CONFIG_ENABLE 0x80000000
+
+/* A vendor ID that reads as all ones means no function is
+   present. */
+#define PCI_NO_VENDOR 0xffff
+
+/* Bit in the header type that marks a multi-function device. */
+#define PCI_HEADER_MULTI 0x80
+
+static void
+select_reg (struct pci_func f, uint8_t reg)
+{
+  ASSERT (f.dev < 32 && f.func < 8);
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (PCI_CONFIG_ENABLE | (f.bus << 16) | (f.dev << 11)
+                          | (f.func << 8) | reg));
+}
+
+/* Returns the 32-bit configuration register REG of function F. */
+uint32_t
+pci_read (struct pci_func f, uint8_t reg)
+{
+  select_reg (f, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function F to
+   VALUE. */
+void
+pci_write (struct pci_func f, uint8_t reg, uint32_t value)
+{
+  select_reg (f, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches every bus for the first function with the given CLASS
+   and SUBCLASS.  If one is found, stores its location in *F and
+   returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_func *f)
+{
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          struct pci_func cur = {bus, dev, func};
+          uint32_t class_reg;
+
+          if ((pci_read (cur, PCI_REG_ID) & 0xffff) == PCI_NO_VENDOR)
+            {
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class_reg = pci_read (cur, PCI_REG_CLASS);
+          if ((class_reg >> 24) == class
+              && ((class_reg >> 16) & 0xff) == subclass)
+            {
+              *f = cur;
+              return true;
+            }
+
+          if (func == 0
+              && !((pci_read (cur, PCI_REG_HEADER) >> 16) & PCI_HEADER_MULTI))
+            break;
+        }
+  return false;
+}
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,39 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a single countdown of CYCLES PIT cycles on channel 0
+   (mode 0, "interrupt on terminal count"), replacing any periodic
+   or one-shot countdown in progress.  Interrupt line 0 fires once
+   when it expires.  CYCLES must be between 1 and
+   PIT_ONESHOT_MAX. */
+void
+pit_oneshot (unsigned cycles)
+{
+  enum intr_level old_level;
+
+  ASSERT (cycles >= 1 && cycles <= PIT_ONESHOT_MAX);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), cycles);
+  outb (PIT_PORT_COUNTER (0), cycles >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns channel 0's current count.  In mode 0 the counter keeps
+   counting down past zero, wrapping to 0xffff, after the
+   countdown expires. */
+uint16_t
+pit_read_count (void)
+{
+  enum intr_level old_level;
+  uint16_t count;
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0x00);        /* Latch channel 0's count. */
+  count = inb (PIT_PORT_COUNTER (0));
+  count |= inb (PIT_PORT_COUNTER (0)) << 8;
+  intr_set_level (old_level);
+  return count;
+}
@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+/* PIT cycles per second. */
+#define PIT_HZ 1193180
+
+/* Longest countdown pit_oneshot() accepts, in PIT cycles. */
+#define PIT_ONESHOT_MAX 0xffff
+
 void pit_configure_channel (int channel, int mode, int frequency);
+void pit_oneshot (unsigned cycles);
+uint16_t pit_read_count (void);
 
 #endif /* devices/pit.h */
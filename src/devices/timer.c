@@ -20,22 +20,96 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Hierarchical timer wheel holding pending timer events.
+
+   Level L has TIMER_WHEEL_SLOTS slots, each covering
+   TIMER_WHEEL_SLOTS^L ticks.  An event goes into the lowest level
+   whose span reaches its expiry; whenever the level-0 index wraps,
+   the next slot of level 1 is cascaded down into level 0, and so
+   on up the levels.  Adding, cancelling and firing an event are
+   all O(1), apart from the occasional cascade. */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+static struct list wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+/* Next tick whose events have not yet been run. */
+static int64_t wheel_now;
+
+/* One-shot ("tickless") mode.
+
+   Instead of running periodically, the PIT counts down once at a
+   time, to the next tick boundary while any thread can run, or,
+   while the CPU idles, to the first tick that has a timer event
+   due (bounded by the PIT's 16-bit counter).  Ticks skipped while
+   idle are caught up when the countdown ends.  Time is kept in
+   PIT cycles, which also lets sub-tick sleeps block until a
+   countdown ends instead of spinning. */
+bool timer_tickless;
+
+/* PIT cycles per timer tick, rounded like pit_configure_channel(). */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Sub-tick sleeps shorter than this many nanoseconds busy-wait,
+   since blocking would cost more than it saves. */
+#define HR_SLEEP_MIN_NS 100000
+
+static uint64_t cycles;         /* Cycles before the current countdown. */
+static unsigned armed;          /* Length of the current countdown. */
+
+/* Threads in sub-tick sleeps, in order of deadline. */
+static struct list hr_sleepers;
+
+/* A thread in a sub-tick sleep. */
+struct hr_sleeper
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    uint64_t deadline;          /* Cycle count at which to wake. */
+    struct thread *thread;      /* Sleeping thread. */
+  };
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time stamp counter cycles per timer tick.
+   Initialized by timer_calibrate(). */
+static uint64_t tsc_per_tick;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
+static uint64_t read_tsc (void);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct timer_event *);
+static void wheel_run (void);
+static void timer_tick (void);
+static void oneshot_interrupt (void);
+static void arm (uint64_t deadline);
+static void hr_sleep (uint64_t delay);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  pit_configure_channel (0, 2, TIMER_FREQ);
+  int level, slot;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_now = 0;
+
+  if (timer_tickless)
+    {
+      list_init (&hr_sleepers);
+      cycles = 0;
+      arm (TICK_CYCLES);
+    }
+  else
+    pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -44,6 +118,8 @@ void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t tsc;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -63,6 +139,16 @@ timer_calibrate (void)
     if (!too_many_loops (loops_per_tick | test_bit))
       loops_per_tick |= test_bit;
 
+  /* Count time stamp counter cycles over one whole tick. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+  tsc = read_tsc ();
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+  tsc_per_tick = read_tsc () - tsc;
+
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
 }
 
@@ -84,6 +170,21 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns a count of microseconds for timing short intervals.
+   After timer_calibrate() it comes from the CPU's time stamp
+   counter; before, it only advances once per tick. */
+int64_t
+timer_usecs (void)
+{
+  uint64_t tsc;
+
+  if (tsc_per_tick == 0)
+    return timer_ticks () * (1000000 / TIMER_FREQ);
+  tsc = read_tsc ();
+  return (tsc / tsc_per_tick * (1000000 / TIMER_FREQ)
+          + tsc % tsc_per_tick * (1000000 / TIMER_FREQ) / tsc_per_tick);
+}
+
 // Lab 1-1. Function edited
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
@@ -91,7 +192,7 @@ void
 timer_sleep (int64_t ticks) 
 {
   int64_t start = timer_ticks ();
-  thread_sleep(start + ticks); // use sleep list instead of yielding in a while loop
+  thread_sleep(start + ticks); // block on a timer event instead of yielding in a while loop
   /*ASSERT (intr_get_level () == INTR_ON);
   while (timer_elapsed (start) < ticks) 
     thread_yield ();*/
@@ -171,13 +272,23 @@ timer_print_stats (void)
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
+{
+  if (timer_tickless)
+    oneshot_interrupt ();
+  else
+    timer_tick ();
+}
+
+/* Does the work due at each timer tick. */
+static void
+timer_tick (void)
 {
   ticks++;
   thread_tick ();
 
   if(thread_mlfqs){   // Lab 1-3.
     mlfqs_recent_cpu_increase();
-    if(ticks % 100 == 0) {
+    if(ticks % TIMER_FREQ == 0) {
       mlfqs_load_avg();
       mlfqs_recent_cpu();
     }
@@ -185,7 +296,266 @@ timer_interrupt (struct intr_frame *args UNUSED)
       mlfqs_priority();
     }
   }
-  thread_awake(ticks); // Lab 1-1.
+  wheel_run ();
+}
+
+/* Starts a countdown ending at cycle DEADLINE, or as soon as
+   possible if that has passed, but no later than the PIT can
+   count.  Interrupts must be off. */
+static void
+arm (uint64_t deadline)
+{
+  uint64_t count = deadline > cycles ? deadline - cycles : 1;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  armed = count < PIT_ONESHOT_MAX ? count : PIT_ONESHOT_MAX;
+  pit_oneshot (armed);
+}
+
+/* Credits the part of the current countdown that has already run
+   to CYCLES, leaving ARMED as what remains, so that the countdown
+   can be replaced.  Returns false if the countdown has already
+   expired and its interrupt is pending.  Interrupts must be
+   off. */
+static bool
+sync_countdown (void)
+{
+  unsigned count = pit_read_count ();
+
+  if (count == 0 || count > armed)
+    return false;
+  cycles += armed - count;
+  armed = count;
+  return true;
+}
+
+/* Returns the cycle count at which the next countdown should
+   end.  Interrupts must be off. */
+static uint64_t
+next_deadline (void)
+{
+  int64_t t = ticks + 1;
+  uint64_t deadline;
+
+  /* While idle, skip ticks with nothing due, stopping where the
+     level-0 index wraps because the cascade there may bring down
+     events due soon. */
+  if (thread_is_idle ())
+    while ((t & TIMER_WHEEL_MASK) != 0
+           && list_empty (&wheel[0][t & TIMER_WHEEL_MASK])
+           && (uint64_t) t * TICK_CYCLES - cycles < PIT_ONESHOT_MAX)
+      t++;
+  deadline = (uint64_t) t * TICK_CYCLES;
+
+  if (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline < deadline)
+        deadline = s->deadline;
+    }
+  return deadline;
+}
+
+/* Timer interrupt handler for one-shot mode. */
+static void
+oneshot_interrupt (void)
+{
+  /* The counter keeps running past zero, so its distance below
+     zero is how late this interrupt is being handled. */
+  cycles += armed + (uint16_t) (0x10000 - pit_read_count ());
+
+  while ((uint64_t) (ticks + 1) * TICK_CYCLES <= cycles)
+    timer_tick ();
+
+  while (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline > cycles)
+        break;
+      list_pop_front (&hr_sleepers);
+      thread_unblock (s->thread);
+    }
+
+  arm (next_deadline ());
+}
+
+/* Called with interrupts off when the CPU stops idling.  If the
+   PIT was set for a long idle countdown, cuts it short at the
+   next tick boundary so that time slices and scheduler
+   statistics resume. */
+void
+timer_leave_idle (void)
+{
+  uint64_t boundary = (uint64_t) (ticks + 1) * TICK_CYCLES;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (timer_tickless && cycles + armed > boundary && sync_countdown ())
+    arm (boundary);
+}
+
+/* Returns true if sleeper A's deadline precedes B's. */
+static bool
+hr_sleeper_less (const struct list_elem *a_, const struct list_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct hr_sleeper *a = list_entry (a_, struct hr_sleeper, elem);
+  const struct hr_sleeper *b = list_entry (b_, struct hr_sleeper, elem);
+  return a->deadline < b->deadline;
+}
+
+/* Blocks the current thread for DELAY PIT cycles, shortening the
+   current countdown if it would end after that. */
+static void
+hr_sleep (uint64_t delay)
+{
+  struct hr_sleeper s;
+  enum intr_level old_level;
+  bool synced;
+
+  old_level = intr_disable ();
+  synced = sync_countdown ();
+  s.deadline = (synced ? cycles : cycles + armed) + delay;
+  s.thread = thread_current ();
+  list_insert_ordered (&hr_sleepers, &s.elem, hr_sleeper_less, NULL);
+  if (synced && s.deadline < cycles + armed)
+    arm (s.deadline);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Initializes EVENT to call FUNC(AUX) when it fires.  EVENT is
+   not pending until passed to timer_event_add(). */
+void
+timer_event_init (struct timer_event *event, timer_event_func *func,
+                  void *aux)
+{
+  ASSERT (event != NULL);
+  ASSERT (func != NULL);
+
+  event->func = func;
+  event->aux = aux;
+  event->pending = false;
+}
+
+/* Arranges for EVENT, which must not be pending, to fire at tick
+   EXPIRES, or at the next tick if EXPIRES has already passed.
+   May be called from an interrupt handler, including EVENT's own
+   function. */
+void
+timer_event_add (struct timer_event *event, int64_t expires)
+{
+  enum intr_level old_level;
+
+  ASSERT (event != NULL);
+  ASSERT (!event->pending);
+
+  old_level = intr_disable ();
+  event->expires = expires;
+  event->pending = true;
+  wheel_insert (event);
+  intr_set_level (old_level);
+}
+
+/* Cancels EVENT if it is pending.  Returns true if it was,
+   false if it had already fired or was never added. */
+bool
+timer_event_cancel (struct timer_event *event)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (event != NULL);
+
+  old_level = intr_disable ();
+  was_pending = event->pending;
+  if (was_pending)
+    {
+      list_remove (&event->elem);
+      event->pending = false;
+    }
+  intr_set_level (old_level);
+  return was_pending;
+}
+
+/* Puts EVENT into the wheel slot for its expiry.
+   Interrupts must be off. */
+static void
+wheel_insert (struct timer_event *event)
+{
+  int64_t expires = event->expires < wheel_now ? wheel_now : event->expires;
+  int64_t delta = expires - wheel_now;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (TIMER_WHEEL_BITS * (level + 1)))
+      break;
+
+  /* Events beyond the top level's reach park in its farthest slot
+     and are re-inserted each time that slot cascades. */
+  if (delta >= (int64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+    expires = wheel_now + ((int64_t) 1 << (TIMER_WHEEL_BITS
+                                           * TIMER_WHEEL_LEVELS)) - 1;
+
+  list_push_back (&wheel[level][(expires >> (TIMER_WHEEL_BITS * level))
+                                & TIMER_WHEEL_MASK],
+                  &event->elem);
+}
+
+/* Moves every event in slot INDEX of LEVEL down to lower levels.
+   Returns INDEX. */
+static int
+wheel_cascade (int level, int index)
+{
+  struct list *slot = &wheel[level][index];
+
+  while (!list_empty (slot))
+    wheel_insert (list_entry (list_pop_front (slot),
+                              struct timer_event, elem));
+  return index;
+}
+
+/* Fires every event that has expired as of the current tick.
+   Called from the timer interrupt handler. */
+static void
+wheel_run (void)
+{
+  while (wheel_now <= ticks)
+    {
+      struct list expired;
+      int index = wheel_now & TIMER_WHEEL_MASK;
+      int level;
+
+      /* When the level-0 index wraps, pull the next slot of each
+         higher level down, stopping at the first that does not
+         wrap too. */
+      for (level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++)
+        index = wheel_cascade (level, (wheel_now >> (TIMER_WHEEL_BITS * level))
+                                      & TIMER_WHEEL_MASK);
+
+      /* Detach this tick's slot and advance before running the
+         handlers, so that an event they re-add for an expiry that
+         has already passed lands in the next tick's slot. */
+      list_init (&expired);
+      while (!list_empty (&wheel[0][wheel_now & TIMER_WHEEL_MASK]))
+        list_push_back (&expired,
+                        list_pop_front (&wheel[0][wheel_now
+                                                  & TIMER_WHEEL_MASK]));
+      wheel_now++;
+
+      while (!list_empty (&expired))
+        {
+          struct timer_event *event = list_entry (list_pop_front (&expired),
+                                                  struct timer_event, elem);
+          event->pending = false;
+          event->func (event->aux);
+        }
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -207,6 +577,15 @@ too_many_loops (unsigned loops)
   return start != ticks;
 }
 
+/* Returns the CPU's time stamp counter. */
+static uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Iterates through a simple loop LOOPS times, for implementing
    brief delays.
 
@@ -241,6 +620,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (timer_tickless && num * 1000 * 1000 * 1000 / denom >= HR_SLEEP_MIN_NS)
+    {
+      /* In one-shot mode, a sub-tick sleep can block until a
+         countdown that ends on time. */
+      hr_sleep (num * PIT_HZ / denom);
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
@@ -1,17 +1,24 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, use one-shot mode instead of periodic interrupts.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_usecs (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -25,5 +32,27 @@ void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
+void timer_leave_idle (void);
+
+/* Kernel timer event.
+
+   Calls FUNC(AUX) from the timer interrupt handler once the tick
+   count reaches EXPIRES.  The handler runs in interrupt context,
+   so it must not sleep; it may re-add its own event to make it
+   periodic. */
+typedef void timer_event_func (void *aux);
+
+struct timer_event
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which to fire. */
+    timer_event_func *func;     /* Function to call. */
+    void *aux;                  /* Argument for FUNC. */
+    bool pending;               /* Added and not yet fired or cancelled? */
+  };
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_add (struct timer_event *, int64_t expires);
+bool timer_event_cancel (struct timer_event *);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,307 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache for file system sectors.
+
+   All file system access to fs_device goes through a small,
+   fixed set of cached sectors.  Victims are chosen by the clock
+   algorithm.  Writes only dirty the cached copy; dirty sectors
+   reach the disk when they are evicted, when the write-behind
+   thread runs, or when the file system shuts down.  Sequential
+   readers can ask for the next sector to be brought in by the
+   read-ahead thread while they work on the current one. */
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind passes. */
+#define CACHE_FLUSH_TICKS (TIMER_FREQ * 2)
+
+/* Maximum number of queued read-ahead requests. */
+#define READ_AHEAD_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct lock lock;                   /* Held during I/O and copies. */
+    block_sector_t sector;              /* Cached sector. */
+    bool in_use;                        /* Holds a sector? */
+    bool valid;                         /* DATA matches or is newer than disk? */
+    bool dirty;                         /* DATA newer than disk? */
+    bool accessed;                      /* Used since clock last passed? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the sector and in_use members of every entry and the
+   clock hand.  An entry's sector may only change while both this
+   lock and the entry's own lock are held. */
+static struct lock cache_lock;
+static size_t cache_clock;
+
+/* Read-ahead queue, a ring of sector numbers. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct semaphore read_ahead_sema;
+
+static thread_func write_behind_thread NO_RETURN;
+static thread_func read_ahead_thread NO_RETURN;
+
+/* Initializes the buffer cache and starts its helper threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      lock_init (&cache[i].lock);
+      cache[i].in_use = false;
+    }
+  cache_clock = 0;
+
+  lock_init (&read_ahead_lock);
+  sema_init (&read_ahead_sema, 0);
+  read_ahead_head = read_ahead_cnt = 0;
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
+}
+
+/* Writes entry E back to disk if it is dirty.
+   E's lock must be held. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  if (e->in_use && e->valid && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+}
+
+/* Returns the entry caching SECTOR, or a null pointer.
+   cache_lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Picks an entry to reuse with the clock algorithm, writes it
+   back if necessary, and returns it with its lock held.  Returns
+   a null pointer if every entry is busy.  cache_lock must be
+   held; it is released while a dirty victim is written back, so
+   the caller must check again that its sector is not cached. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[cache_clock];
+      cache_clock = (cache_clock + 1) % CACHE_SIZE;
+
+      if (!lock_try_acquire (&e->lock))
+        continue;
+      if (!e->in_use)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Written back without cache_lock, so that other sectors
+         can be looked up meanwhile.  E keeps its old sector until
+         the caller retags it, so a lookup for that sector finds E
+         and waits on its lock instead of missing and reading
+         stale data from disk. */
+      if (e->dirty)
+        {
+          lock_release (&cache_lock);
+          write_back (e);
+          lock_acquire (&cache_lock);
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR with its lock held, loading the
+   sector from disk unless WILL_OVERWRITE is true, in which case
+   the caller promises to overwrite the entire sector. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool will_overwrite)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->in_use && e->sector == sector)
+            break;
+
+          /* Evicted while we waited.  Try again. */
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e = evict ();
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+      if (lookup (sector) != NULL)
+        {
+          /* Someone else cached SECTOR while E was written back.
+             E keeps its old sector, clean now. */
+          lock_release (&e->lock);
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->in_use = true;
+      e->sector = sector;
+      e->valid = false;
+      e->dirty = false;
+      lock_release (&cache_lock);
+      break;
+    }
+
+  if (!e->valid && !will_overwrite)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  e->accessed = true;
+  return e;
+}
+
+/* Copies SIZE bytes starting at SECTOR_OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int sector_ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0
+          && sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false);
+  memcpy (buffer, e->data + sector_ofs, size);
+  lock_release (&e->lock);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at
+   SECTOR_OFS.  The sector reaches the disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer, int sector_ofs,
+             int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0
+          && sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, sector_ofs == 0 && size == BLOCK_SECTOR_SIZE);
+  memcpy (e->data + sector_ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  lock_release (&e->lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Does not wait.  The request is dropped if the queue is full. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_MAX;
+      read_ahead_queue[tail] = sector;
+      read_ahead_cnt++;
+      sema_up (&read_ahead_sema);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Writes every dirty cached sector to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&e->lock);
+      write_back (e);
+      lock_release (&e->lock);
+    }
+}
+
+/* Flushes the cache as the file system shuts down. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* Periodically writes dirty sectors back to disk, so that a
+   crash loses at most CACHE_FLUSH_TICKS worth of writes. */
+static void
+write_behind_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Services cache_read_ahead() requests. */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      struct cache_entry *e;
+
+      sema_down (&read_ahead_sema);
+      lock_acquire (&read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      e = cache_get (sector, false);
+      lock_release (&e->lock);
+    }
+}
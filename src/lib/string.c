@@ -1,5 +1,36 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below move 32-bit words at a time once a
+   block is big enough to be worth aligning.  Below this many
+   bytes they go a byte at a time. */
+#define WORD_MIN 16
+
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Copies SIZE bytes from SRC to DST, ascending, with the string
+   instructions: bytes up to a word boundary of DST, then words,
+   then the leftover bytes.  Returns DST + SIZE. */
+static unsigned char *
+copy_up (unsigned char *dst, const unsigned char *src, size_t size)
+{
+  if (size >= WORD_MIN)
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size = (size - head) % 4;
+      asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (head)
+                    : : "memory");
+      asm volatile ("rep movsl" : "+D" (dst), "+S" (src), "+c" (words)
+                    : : "memory");
+    }
+  asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (size)
+                : : "memory");
+  return dst;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,9 +43,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
-
+  copy_up (dst, src, size);
   return dst_;
 }
 
@@ -30,19 +59,36 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (src != NULL || size == 0);
 
   if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
+    copy_up (dst, src, size);
   else 
     {
       dst += size;
       src += size;
+      if (size >= WORD_MIN)
+        {
+          /* Bytes down to a word boundary of DST, then words copied
+             descending with the direction flag set.  Interrupt
+             entry clears the flag and iret restores it. */
+          size_t head = (uintptr_t) dst & 3;
+          size_t words;
+
+          size -= head;
+          while (head-- > 0)
+            *--dst = *--src;
+          words = size / 4;
+          size %= 4;
+          dst -= 4;
+          src -= 4;
+          asm volatile ("std; rep movsl; cld"
+                        : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+          dst += 4;
+          src += 4;
+        }
       while (size-- > 0)
         *--dst = *--src;
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +104,12 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip matching words, then find the differing byte. */
+  if (size >= WORD_MIN)
+    for (; size >= 4 && *(const word_t *) a == *(const word_t *) b;
+         a += 4, b += 4, size -= 4)
+      continue;
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -282,8 +334,20 @@ memset (void *dst_, int value, size_t size)
 
   ASSERT (dst != NULL || size == 0);
   
-  while (size-- > 0)
-    *dst++ = value;
+  if (size >= WORD_MIN)
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+      uint32_t pattern = (unsigned char) value * 0x01010101u;
+
+      size = (size - head) % 4;
+      asm volatile ("rep stosb" : "+D" (dst), "+c" (head) : "a" (value)
+                    : "memory");
+      asm volatile ("rep stosl" : "+D" (dst), "+c" (words) : "a" (pattern)
+                    : "memory");
+    }
+  asm volatile ("rep stosb" : "+D" (dst), "+c" (size) : "a" (value)
+                : "memory");
 
   return dst_;
 }
@@ -293,10 +357,20 @@ size_t
 strlen (const char *string) 
 {
   const char *p;
+  const word_t *w;
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Bytes up to a word boundary, then whole words until one has
+     a zero byte.  Aligned words never cross into an unmapped
+     page that the string does not reach. */
+  for (p = string; (uintptr_t) p & 3; p++)
+    if (*p == '\0')
+      return p - string;
+  for (w = (const word_t *) p;
+       ((*w - 0x01010101u) & ~*w & 0x80808080u) == 0; w++)
+    continue;
+  for (p = (const char *) w; *p != '\0'; p++)
     continue;
   return p - string;
 }
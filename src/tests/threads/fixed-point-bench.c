@@ -0,0 +1,185 @@
+/* Times a simulation of the advanced scheduler's per-tick
+   bookkeeping for a set of threads, first the way it used to be
+   done and then the way thread.c does it now, and checks that
+   both produce the same load_avg, recent_cpu and priorities.
+
+   The old way calls out-of-line fixed-point functions that
+   divide for every multiplication, recomputes 59/60 and 1/60 at
+   every use, and recomputes every thread's priority every fourth
+   tick.  The new way uses the inline functions and constants from
+   fixed_point_operation.h and, between the once-per-second decays,
+   recomputes only the running thread's priority. */
+
+#include <debug.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/fixed_point_operation.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 64
+#define SECONDS 1000
+
+/* Scheduler state of one simulated thread. */
+struct sim_thread
+  {
+    int nice;
+    int recent_cpu;
+    int priority;
+  };
+
+static struct sim_thread old_threads[THREAD_CNT], new_threads[THREAD_CNT];
+static int old_load_avg, new_load_avg;
+
+/* The fixed-point functions as they used to be. */
+static NO_INLINE int old_n_to_fp (int n) { return n * FP_ONE; }
+static NO_INLINE int old_x_to_int_nearest (int x)
+{
+  return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+static NO_INLINE int old_add_x_y (int x, int y) { return x + y; }
+static NO_INLINE int old_sub_x_y (int x, int y) { return x - y; }
+static NO_INLINE int old_add_x_n (int x, int n) { return x + n * FP_ONE; }
+static NO_INLINE int old_mul_x_y (int x, int y)
+{
+  return ((int64_t) x) * y / FP_ONE;
+}
+static NO_INLINE int old_mul_x_n (int x, int n) { return x * n; }
+static NO_INLINE int old_div_x_y (int x, int y)
+{
+  return ((int64_t) x) * FP_ONE / y;
+}
+static NO_INLINE int old_div_x_n (int x, int n) { return x / n; }
+
+static void
+init_threads (struct sim_thread *threads)
+{
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      threads[i].nice = i % 41 - 20;
+      threads[i].recent_cpu = 0;
+      threads[i].priority = PRI_DEFAULT;
+    }
+}
+
+static int
+clamp_priority (int priority)
+{
+  return priority < PRI_MIN ? PRI_MIN : priority > PRI_MAX ? PRI_MAX : priority;
+}
+
+static void
+old_priority (struct sim_thread *t)
+{
+  t->priority = clamp_priority (
+    old_sub_x_y (old_sub_x_y (PRI_MAX,
+                              old_x_to_int_nearest (old_div_x_n (t->recent_cpu, 4))),
+                 old_mul_x_n (t->nice, 2)));
+}
+
+static void
+new_priority (struct sim_thread *t)
+{
+  t->priority = clamp_priority (PRI_MAX
+                                - x_to_int_nearest (div_x_n (t->recent_cpu, 4))
+                                - t->nice * 2);
+}
+
+/* Simulates SECONDS seconds of ticks the old way. */
+static void
+run_old (void)
+{
+  int64_t tick;
+  int i;
+
+  for (tick = 1; tick <= (int64_t) SECONDS * TIMER_FREQ; tick++)
+    {
+      struct sim_thread *cur = &old_threads[tick / 4 % THREAD_CNT];
+
+      cur->recent_cpu = old_add_x_n (cur->recent_cpu, 1);
+      if (tick % TIMER_FREQ == 0)
+        {
+          int mid = old_mul_x_y (old_div_x_y (old_n_to_fp (59), old_n_to_fp (60)),
+                                 old_load_avg);
+          old_load_avg = old_add_x_y (mid, old_mul_x_n (old_div_x_y (old_n_to_fp (1),
+                                                                     old_n_to_fp (60)),
+                                                        THREAD_CNT));
+          for (i = 0; i < THREAD_CNT; i++)
+            {
+              struct sim_thread *t = &old_threads[i];
+              t->recent_cpu = old_add_x_n (
+                old_mul_x_y (old_div_x_y (old_mul_x_n (old_load_avg, 2),
+                                          old_add_x_n (old_mul_x_n (old_load_avg, 2), 1)),
+                             t->recent_cpu),
+                t->nice);
+            }
+        }
+      if (tick % 4 == 0)
+        for (i = 0; i < THREAD_CNT; i++)
+          old_priority (&old_threads[i]);
+    }
+}
+
+/* Simulates SECONDS seconds of ticks the way thread.c does now. */
+static void
+run_new (void)
+{
+  int64_t tick;
+  int i;
+
+  for (tick = 1; tick <= (int64_t) SECONDS * TIMER_FREQ; tick++)
+    {
+      struct sim_thread *cur = &new_threads[tick / 4 % THREAD_CNT];
+
+      cur->recent_cpu = add_x_n (cur->recent_cpu, 1);
+      if (tick % TIMER_FREQ == 0)
+        {
+          fixed_t coef;
+
+          new_load_avg = add_x_y (mul_x_y (FP_FRAC (59, 60), new_load_avg),
+                                  mul_x_n (FP_FRAC (1, 60), THREAD_CNT));
+          coef = div_x_y (mul_x_n (new_load_avg, 2),
+                          add_x_n (mul_x_n (new_load_avg, 2), 1));
+          for (i = 0; i < THREAD_CNT; i++)
+            {
+              struct sim_thread *t = &new_threads[i];
+              t->recent_cpu = add_x_n (mul_x_y (coef, t->recent_cpu), t->nice);
+              new_priority (t);
+            }
+        }
+      if (tick % 4 == 0)
+        new_priority (cur);
+    }
+}
+
+void
+test_fixed_point_bench (void) 
+{
+  int64_t start;
+  int i;
+
+  msg ("Simulating %d seconds of ticks for %d threads.", SECONDS, THREAD_CNT);
+
+  init_threads (old_threads);
+  start = timer_ticks ();
+  run_old ();
+  msg ("old: %lld ticks.", timer_elapsed (start));
+
+  init_threads (new_threads);
+  start = timer_ticks ();
+  run_new ();
+  msg ("new: %lld ticks.", timer_elapsed (start));
+
+  if (old_load_avg != new_load_avg)
+    fail ("load_avg differs: old %d, new %d", old_load_avg, new_load_avg);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (old_threads[i].recent_cpu != new_threads[i].recent_cpu
+        || old_threads[i].priority != new_threads[i].priority)
+      fail ("thread %d differs: old recent_cpu %d priority %d, "
+            "new recent_cpu %d priority %d", i,
+            old_threads[i].recent_cpu, old_threads[i].priority,
+            new_threads[i].recent_cpu, new_threads[i].priority);
+  msg ("Results match.");
+}
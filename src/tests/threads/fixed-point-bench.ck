@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run.
+@output = grep (!/ ticks\.$/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(fixed-point-bench) begin
+(fixed-point-bench) Simulating 1000 seconds of ticks for 64 threads.
+(fixed-point-bench) Results match.
+(fixed-point-bench) end
+EOF
+pass;
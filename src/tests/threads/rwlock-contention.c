@@ -0,0 +1,173 @@
+/* Checks the reader-writer lock, then measures it under
+   contention.
+
+   First, the main thread holds an rwlock for reading while a
+   higher-priority writer waits for it, which must donate its
+   priority to the main thread.  A still higher-priority reader
+   that arrives while the writer waits must not overtake it.
+
+   Then a mix of readers and writers, each of which sleeps for a
+   tick inside its critical section, runs once with a plain lock
+   and once with an rwlock, and the elapsed ticks are reported.
+   Readers must overlap under the rwlock, and no reader may ever
+   see a writer inside. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define READER_CNT 6
+#define WRITER_CNT 2
+#define ITER_CNT 10
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+static thread_func bench_reader_func;
+static thread_func bench_writer_func;
+
+static struct rwlock rwlock;
+
+/* State for the contention benchmark. */
+static bool use_rwlock;                 /* rwlock or plain lock? */
+static struct lock plain_lock;
+static struct semaphore done;
+static int active_readers, max_readers;
+static bool writer_active;
+
+static int64_t run_bench (bool);
+
+void
+test_rwlock_contention (void) 
+{
+  int64_t lock_ticks, rwlock_ticks;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  rwlock_acquire_read (&rwlock);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, NULL);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("reader", PRI_DEFAULT + 3, reader_thread_func, NULL);
+  rwlock_release_read (&rwlock);
+  msg ("writer, reader must already have finished, in that order.");
+
+  msg ("%d readers, %d writers, %d iterations each.",
+       READER_CNT, WRITER_CNT, ITER_CNT);
+  lock_ticks = run_bench (false);
+  msg ("lock: %lld ticks.", lock_ticks);
+  rwlock_ticks = run_bench (true);
+  msg ("rwlock: %lld ticks.", rwlock_ticks);
+  if (max_readers < 2)
+    fail ("readers never overlapped under the rwlock");
+  msg ("Readers overlapped under the rwlock.");
+}
+
+static void
+writer_thread_func (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rwlock);
+  msg ("writer: got the lock");
+  rwlock_release_write (&rwlock);
+  msg ("writer: done");
+}
+
+static void
+reader_thread_func (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rwlock);
+  msg ("reader: got the lock");
+  rwlock_release_read (&rwlock);
+  msg ("reader: done");
+}
+
+/* Runs READER_CNT readers and WRITER_CNT writers to completion,
+   using an rwlock if USE is true or a plain lock otherwise, and
+   returns the number of ticks taken. */
+static int64_t
+run_bench (bool use) 
+{
+  int64_t start;
+  int i;
+
+  use_rwlock = use;
+  rwlock_init (&rwlock);
+  lock_init (&plain_lock);
+  sema_init (&done, 0);
+  active_readers = max_readers = 0;
+  writer_active = false;
+
+  start = timer_ticks ();
+  for (i = 0; i < READER_CNT + WRITER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "bench %d", i);
+      thread_create (name, PRI_DEFAULT,
+                     i < READER_CNT ? bench_reader_func : bench_writer_func,
+                     NULL);
+    }
+  for (i = 0; i < READER_CNT + WRITER_CNT; i++)
+    sema_down (&done);
+  return timer_elapsed (start);
+}
+
+static void
+bench_reader_func (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      if (use_rwlock)
+        rwlock_acquire_read (&rwlock);
+      else
+        lock_acquire (&plain_lock);
+
+      if (writer_active)
+        fail ("reader saw an active writer");
+      if (++active_readers > max_readers)
+        max_readers = active_readers;
+      timer_sleep (1);
+      active_readers--;
+
+      if (use_rwlock)
+        rwlock_release_read (&rwlock);
+      else
+        lock_release (&plain_lock);
+    }
+  sema_up (&done);
+}
+
+static void
+bench_writer_func (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      if (use_rwlock)
+        rwlock_acquire_write (&rwlock);
+      else
+        lock_acquire (&plain_lock);
+
+      if (writer_active || active_readers > 0)
+        fail ("writer did not have exclusive access");
+      writer_active = true;
+      timer_sleep (1);
+      writer_active = false;
+
+      if (use_rwlock)
+        rwlock_release_write (&rwlock);
+      else
+        lock_release (&plain_lock);
+      timer_sleep (1);
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run.
+@output = grep (!/ ticks\.$/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(rwlock-contention) begin
+(rwlock-contention) This thread should have priority 33.  Actual priority: 33.
+(rwlock-contention) writer: got the lock
+(rwlock-contention) reader: got the lock
+(rwlock-contention) reader: done
+(rwlock-contention) writer: done
+(rwlock-contention) writer, reader must already have finished, in that order.
+(rwlock-contention) 6 readers, 2 writers, 10 iterations each.
+(rwlock-contention) Readers overlapped under the rwlock.
+(rwlock-contention) end
+EOF
+pass;
@@ -0,0 +1,153 @@
+/* Checks memcpy, memmove, memset, memcmp and strlen against
+   byte-at-a-time versions for every combination of source and
+   destination alignment, then times memcpy, memset and a byte
+   loop on blocks from 1 byte up to a page. */
+
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Bytes moved per timing, so that every block size does the
+   same amount of work. */
+#define BENCH_BYTES (8 * 1024 * 1024)
+
+static const size_t sizes[] = {1, 4, 16, 64, 256, 1024, PGSIZE};
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+static unsigned char src[PGSIZE + 8], dst[PGSIZE + 8], ref[PGSIZE + 8];
+
+static NO_INLINE void
+byte_copy (unsigned char *d, const unsigned char *s, size_t size)
+{
+  while (size-- > 0)
+    *d++ = *s++;
+}
+
+static NO_INLINE void
+byte_copy_down (unsigned char *d, const unsigned char *s, size_t size)
+{
+  while (size-- > 0)
+    d[size] = s[size];
+}
+
+static NO_INLINE void
+byte_set (unsigned char *d, int value, size_t size)
+{
+  while (size-- > 0)
+    *d++ = value;
+}
+
+static void
+fill (unsigned char *p, size_t size, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = seed + i * 7;
+}
+
+/* Fails unless DST matches REF, naming OP. */
+static void
+expect_same (const char *op, size_t size, size_t offset)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof dst; i++)
+    if (dst[i] != ref[i])
+      fail ("%s of %zu bytes at +%zu: byte %zu is %d, expected %d",
+            op, size, offset, i, dst[i], ref[i]);
+}
+
+/* Compares the string functions against the byte loops. */
+static void
+check (void)
+{
+  size_t so, doff, size, i;
+
+  for (so = 0; so < 4; so++)
+    for (doff = 0; doff < 4; doff++)
+      for (size = 0; size <= 96; size++)
+        {
+          fill (src, sizeof src, so);
+          fill (dst, sizeof dst, 100 + doff);
+          byte_copy (ref, dst, sizeof ref);
+
+          memcpy (dst + doff, src + so, size);
+          byte_copy (ref + doff, src + so, size);
+          expect_same ("memcpy", size, doff);
+
+          memset (dst + doff, so + 1, size);
+          byte_set (ref + doff, so + 1, size);
+          expect_same ("memset", size, doff);
+
+          fill (dst, sizeof dst, 200 + so);
+          byte_copy (ref, dst, sizeof ref);
+          memmove (dst + doff + so, dst + doff, size);
+          byte_copy_down (ref + doff + so, ref + doff, size);
+          expect_same ("memmove up", size, doff);
+
+          memmove (dst + doff, dst + doff + so, size);
+          byte_copy (ref + doff, ref + doff + so, size);
+          expect_same ("memmove down", size, doff);
+
+          if (memcmp (dst + doff, ref + doff, size) != 0)
+            fail ("memcmp of %zu equal bytes at +%zu", size, doff);
+          if (size > 0)
+            {
+              ref[doff + size - 1]++;
+              if (memcmp (dst + doff, ref + doff, size) >= 0)
+                fail ("memcmp of %zu bytes at +%zu", size, doff);
+              ref[doff + size - 1]--;
+            }
+
+          for (i = 0; i < sizeof dst; i++)
+            dst[i] = 'x';
+          dst[so + size] = '\0';
+          if (strlen ((char *) dst + so) != size)
+            fail ("strlen of %zu bytes at +%zu", size, so);
+        }
+  msg ("Results match.");
+}
+
+/* Times memcpy, memset and byte_copy() on blocks of each size. */
+static void
+bench (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE_CNT; i++)
+    {
+      size_t size = sizes[i];
+      size_t reps = BENCH_BYTES / size;
+      int64_t start, copy, set, bytes;
+      size_t r;
+
+      start = timer_ticks ();
+      for (r = 0; r < reps; r++)
+        memcpy (dst, src, size);
+      copy = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (r = 0; r < reps; r++)
+        memset (dst, r, size);
+      set = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (r = 0; r < reps; r++)
+        byte_copy (dst, src, size);
+      bytes = timer_elapsed (start);
+
+      msg ("%zu bytes: memcpy %lld, memset %lld, byte loop %lld ticks.",
+           size, copy, set, bytes);
+    }
+}
+
+void
+test_string_bench (void)
+{
+  check ();
+  bench ();
+}
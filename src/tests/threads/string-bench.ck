@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run.
+@output = grep (!/ ticks\.$/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(string-bench) begin
+(string-bench) Results match.
+(string-bench) end
+EOF
+pass;
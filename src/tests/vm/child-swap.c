@@ -0,0 +1,30 @@
+/* Fills a 2 MB array with a pattern that depends on argv[1],
+   which is more than fits in memory alongside a second copy of
+   itself, then checks it.  Exits with status 42. */
+
+#include <debug.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static unsigned char buf[SIZE];
+
+int
+main (int argc UNUSED, char *argv[])
+{
+  int seed = atoi (argv[1]);
+  size_t i;
+
+  test_name = "child-swap";
+  quiet = true;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i * 7 + seed;
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (unsigned char) (i * 7 + seed))
+      fail ("byte %zu is %d, expected %d", i, buf[i],
+            (unsigned char) (i * 7 + seed));
+  return 42;
+}
@@ -0,0 +1,62 @@
+/* Forks a child that shares the parent's data pages copy-on-write.
+   The child checks that it sees the parent's data, then changes
+   its copy both by storing to it and by read()ing a file into it,
+   and the parent checks that its own copy did not change. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+static void
+fill (char value)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = value + i % 251;
+}
+
+static bool
+filled (char value)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (value + i % 251))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  fill ('a');
+  child = fork ();
+  if (child == 0)
+    {
+      int handle;
+
+      test_name = "child";
+      CHECK (filled ('a'), "buffer has parent's data");
+      fill ('b');
+      CHECK (filled ('b'), "wrote own copy");
+      CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+      CHECK (read (handle, buf + SIZE / 2, sizeof sample - 1)
+             == (int) sizeof sample - 1, "read \"sample.txt\"");
+      CHECK (!memcmp (buf + SIZE / 2, sample, sizeof sample - 1),
+             "read data matches");
+      exit (81);
+    }
+  if (child == -1)
+    fail ("fork");
+  CHECK (wait (child) == 81, "wait for child");
+  CHECK (filled ('a'), "parent's buffer unchanged");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(child) buffer has parent's data
+(child) wrote own copy
+(child) open "sample.txt"
+(child) read "sample.txt"
+(child) read data matches
+(fork-cow) wait for child
+(fork-cow) parent's buffer unchanged
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,36 @@
+/* Reads all of a 2 MB zero-filled array, more than fits in
+   physical memory if each page took a frame of its own, then
+   writes to some of its pages and checks that only those
+   changed. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE 4096
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %d before any write", i, buf[i]);
+  msg ("read zeros");
+
+  for (i = 0; i < SIZE; i += 16 * PAGE)
+    memset (buf + i, i / PAGE, PAGE);
+  msg ("wrote every 16th page");
+
+  for (i = 0; i < SIZE; i++)
+    {
+      char expected = i / PAGE % 16 == 0 ? (char) (i / PAGE) : 0;
+      if (buf[i] != expected)
+        fail ("byte %zu is %d, expected %d", i, buf[i], expected);
+    }
+  msg ("read back");
+}
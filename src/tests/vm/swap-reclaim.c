@@ -0,0 +1,36 @@
+/* Runs pairs of child processes that each push about 2 MB out to
+   swap, round after round.  Swap only holds a few rounds' worth,
+   so this fails unless swap slots are returned when a process
+   exits. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 10
+#define CHILDREN 2
+
+void
+test_main (void)
+{
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      pid_t children[CHILDREN];
+      int i;
+
+      quiet = true;
+      for (i = 0; i < CHILDREN; i++)
+        {
+          char cmd[32];
+          snprintf (cmd, sizeof cmd, "child-swap %d", round * CHILDREN + i);
+          CHECK ((children[i] = exec (cmd)) != -1, "exec \"%s\"", cmd);
+        }
+      for (i = 0; i < CHILDREN; i++)
+        CHECK (wait (children[i]) == 42, "wait for child %d", i);
+      quiet = false;
+      msg ("round %d", round);
+    }
+}
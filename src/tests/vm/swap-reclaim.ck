@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-reclaim) begin
+(swap-reclaim) round 0
+(swap-reclaim) round 1
+(swap-reclaim) round 2
+(swap-reclaim) round 3
+(swap-reclaim) round 4
+(swap-reclaim) round 5
+(swap-reclaim) round 6
+(swap-reclaim) round 7
+(swap-reclaim) round 8
+(swap-reclaim) round 9
+(swap-reclaim) end
+EOF
+pass;
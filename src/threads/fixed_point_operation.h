@@ -1,47 +1,70 @@
+#ifndef THREADS_FIXED_POINT_OPERATION_H
+#define THREADS_FIXED_POINT_OPERATION_H
+
 #include <stdint.h>
-#define f (1<<14)
 
-int n_to_fp(int n) {
-  return n*f;
+/* 17.14 fixed-point arithmetic for the advanced scheduler.
+
+   A fixed_t holds a real number scaled by FP_ONE.  In the names
+   below, X and Y are fixed-point values and N is an integer.
+   Everything is static inline so that the timer interrupt pays
+   no call overhead, and only div_x_y() needs a 64-bit division. */
+typedef int fixed_t;
+
+#define FP_SHIFT 14
+#define FP_ONE (1 << FP_SHIFT)
+
+/* Fixed-point constant for the fraction NUM/DENOM, folded at
+   compile time. */
+#define FP_FRAC(NUM, DENOM) ((fixed_t) ((NUM) * FP_ONE / (DENOM)))
+
+static inline fixed_t n_to_fp(int n) {
+  return n * FP_ONE;
+}
+
+static inline int x_to_int_zero(fixed_t x) {
+  return x / FP_ONE;
 }
 
-int x_to_int_zero(int x) {
-  return x/f;
+static inline int x_to_int_nearest(fixed_t x) {
+  if (x >= 0) {return (x + FP_ONE / 2) / FP_ONE;}
+  else {return (x - FP_ONE / 2) / FP_ONE;}
 }
 
-int x_to_int_nearest(int x) {
-  if (x>=0) {return (x+f/2)/f;}
-  else if(x<=0) {return (x-f/2)/f;}
+static inline fixed_t add_x_y(fixed_t x, fixed_t y) {
+  return x + y;
 }
 
-int add_x_y(int x, int y) {
-  return x+y;
+static inline fixed_t sub_x_y(fixed_t x, fixed_t y) {
+  return x - y;
 }
 
-int sub_x_y(int x, int y){
-  return x-y;
+static inline fixed_t add_x_n(fixed_t x, int n) {
+  return x + n * FP_ONE;
 }
 
-int add_x_n(int x, int n){
-  return x+n*f;
+static inline fixed_t sub_x_n(fixed_t x, int n) {
+  return x - n * FP_ONE;
 }
 
-int sub_x_n(int x, int n){
-  return x-n*f;
+/* Shifts instead of dividing by FP_ONE, adding FP_ONE - 1 to a
+   negative product first so that it still rounds toward zero. */
+static inline fixed_t mul_x_y(fixed_t x, fixed_t y) {
+  int64_t p = (int64_t) x * y;
+  if (p < 0) {p += FP_ONE - 1;}
+  return p >> FP_SHIFT;
 }
 
-int mul_x_y(int x, int y){
-  return ((int64_t)x)*y/f;
+static inline fixed_t mul_x_n(fixed_t x, int n) {
+  return x * n;
 }
 
-int mul_x_n(int x, int n){
-  return x*n;
+static inline fixed_t div_x_y(fixed_t x, fixed_t y) {
+  return (int64_t) x * FP_ONE / y;
 }
 
-int div_x_y(int x, int y){
-  return ((int64_t)x)*f/y;
+static inline fixed_t div_x_n(fixed_t x, int n) {
+  return x / n;
 }
 
-int div_x_n(int x, int n){
-  return x/n;
-}
\ No newline at end of file
+#endif /* threads/fixed_point_operation.h */
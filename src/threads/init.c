@@ -59,6 +59,19 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/* -lowat, -hiwat: Free frame watermarks for the page-out daemon.
+   Zero selects a default based on the size of the user pool. */
+static size_t pageout_low_wat;
+static size_t pageout_high_wat;
+
+/* -fault-around: Pages mapped around each file page fault. */
+static int fault_around_pages = -1;
+
+/* -zswap: Kernel pages for compressed swap. */
+static int zswap_pages = -1;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -101,7 +114,14 @@ main (void)
   malloc_init ();
   paging_init ();
 
+#ifdef VM
+  frame_set_watermarks (pageout_low_wat, pageout_high_wat);
+  if (fault_around_pages >= 0)
+    process_set_fault_around (fault_around_pages);
+  if (zswap_pages >= 0)
+    swap_set_ram_pages (zswap_pages);
   frame_table_init(); // Lab 3
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -132,6 +152,7 @@ main (void)
 #endif
 #ifdef VM // Lab 3
   swap_init();
+  frame_pageout_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -263,9 +284,21 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-lowat"))
+        pageout_low_wat = atoi (value);
+      else if (!strcmp (name, "-hiwat"))
+        pageout_high_wat = atoi (value);
+      else if (!strcmp (name, "-fault-around"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -386,8 +419,15 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Program the timer one-shot and skip idle ticks.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -lowat=COUNT       Start paging out below COUNT free frames.\n"
+          "  -hiwat=COUNT       Page out until COUNT frames are free.\n"
+          "  -fault-around=CNT  Map up to CNT pages around a file fault.\n"
+          "  -zswap=PAGES       Keep compressed swap in PAGES kernel pages.\n"
 #endif
           );
   shutdown_power_off ();
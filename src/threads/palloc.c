@@ -148,6 +148,24 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the index of PAGE within the user pool, counting from
+   the pool's first page, or SIZE_MAX if PAGE was not allocated
+   from the user pool. */
+size_t
+palloc_user_page_idx (void *page)
+{
+  if (page == NULL || !page_from_pool (&user_pool, page))
+    return SIZE_MAX;
+  return pg_no (page) - pg_no (user_pool.base);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -118,10 +118,11 @@ sema_up (struct semaphore *sema)
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
   {
-    /*thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));*/
-    list_sort(&sema->waiters, compare_priority, NULL); // Lab 1-2.
-    thread_unblock(list_entry(list_pop_front(&sema->waiters), struct thread, elem)); // Lab 1-2.
+    /* Waiters' priorities may have changed through donation since
+       they were queued, so take the highest rather than the front. */
+    struct list_elem *e = list_min(&sema->waiters, compare_priority, NULL); // Lab 1-2.
+    list_remove(e);
+    thread_unblock(list_entry(e, struct thread, elem)); // Lab 1-2.
   }
   sema->value++;
   
@@ -371,6 +372,157 @@ cond_broadcast (struct condition *cond, struct lock *lock)
     cond_signal (cond, lock);
 }
 
+/* Initializes RW as a reader-writer lock held by nobody.
+
+   A thread may hold at most RWLOCK_READ_MAX rwlocks for reading
+   at a time.  Like locks, rwlocks are not recursive: a thread
+   that holds RW in either mode must not acquire it again, since
+   a waiting writer would then block it forever. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->writer);
+  rw->reader_cnt = 0;
+  list_init (&rw->readers);
+  rw->waiting_writer = NULL;
+}
+
+/* Raises every active reader of RW to at least the current
+   thread's priority, following each reader's chain of waited-on
+   locks like priority_donation() does.  The boost is dropped by
+   priority_update() when the reader releases RW.
+   Interrupts must be off. */
+static void
+rwlock_donate (struct rwlock *rw)
+{
+  int priority = thread_current ()->priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&rw->readers); e != list_end (&rw->readers);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct rwlock_reader, elem)->thread;
+      int depth;
+
+      for (depth = 0; t != NULL && depth < 8; depth++)
+        {
+          if (t->priority >= priority)
+            break;
+          thread_change_priority (t, priority);
+          t = t->waiting_lock != NULL ? t->waiting_lock->holder : NULL;
+        }
+    }
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  Waiting readers donate their priority to
+   the writer through RW's internal lock. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_reader *r = NULL;
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  for (i = 0; i < RWLOCK_READ_MAX; i++)
+    if (cur->read_locks[i].rwlock == NULL)
+      {
+        r = &cur->read_locks[i];
+        break;
+      }
+  ASSERT (r != NULL);
+
+  lock_acquire (&rw->writer);
+  old_level = intr_disable ();
+  r->rwlock = rw;
+  r->thread = cur;
+  list_push_back (&rw->readers, &r->elem);
+  rw->reader_cnt++;
+  intr_set_level (old_level);
+  lock_release (&rw->writer);
+}
+
+/* Releases RW, which the current thread must hold for reading,
+   and wakes a writer waiting for the last reader to leave. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_reader *r = NULL;
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (rw != NULL);
+
+  for (i = 0; i < RWLOCK_READ_MAX; i++)
+    if (cur->read_locks[i].rwlock == rw)
+      {
+        r = &cur->read_locks[i];
+        break;
+      }
+  ASSERT (r != NULL);
+
+  old_level = intr_disable ();
+  list_remove (&r->elem);
+  r->rwlock = NULL;
+  if (--rw->reader_cnt == 0 && rw->waiting_writer != NULL)
+    {
+      thread_unblock (rw->waiting_writer);
+      rw->waiting_writer = NULL;
+    }
+  if (!thread_mlfqs)
+    priority_update ();
+  thread_yield_on_priority ();
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds
+   it and every active reader has released it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->writer);
+  old_level = intr_disable ();
+  while (rw->reader_cnt > 0)
+    {
+      rw->waiting_writer = thread_current ();
+      if (!thread_mlfqs)
+        rwlock_donate (rw);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rwlock_held_for_write (rw));
+
+  lock_release (&rw->writer);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->writer) && rw->reader_cnt == 0;
+}
 
 // Lab 1. New functions implemented
 // 1-2. Priority scheduler
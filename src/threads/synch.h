@@ -41,6 +41,39 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock.
+
+   Any number of readers, or a single writer, may hold it.  A
+   writer that arrives while readers are active keeps new readers
+   out until it has had its turn, and donates its priority to the
+   active readers while it waits. */
+struct rwlock
+  {
+    struct lock writer;         /* Held by the writer; passed by readers. */
+    unsigned reader_cnt;        /* Number of active readers. */
+    struct list readers;        /* Active readers' rwlock_reader slots. */
+    struct thread *waiting_writer; /* Writer waiting for readers to leave. */
+  };
+
+/* Maximum number of rwlocks one thread may hold for reading at
+   once. */
+#define RWLOCK_READ_MAX 4
+
+/* Per-thread record of one rwlock held for reading. */
+struct rwlock_reader
+  {
+    struct list_elem elem;      /* Element in rwlock's readers list. */
+    struct rwlock *rwlock;      /* Held rwlock, or null if slot free. */
+    struct thread *thread;      /* Reading thread. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 // Lab 1. New functions implemented
 // 1-2. Priority scheduler
 bool compare_sema_priority(const struct list_elem *e1, const struct list_elem *e2, void *aux);
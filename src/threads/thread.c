@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/fixed_point_operation.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
@@ -21,14 +22,17 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority; bit P of ready_mask is
+   set if and only if ready_lists[P] is nonempty. */
+static struct list ready_lists[PRI_MAX + 1];
+static uint64_t ready_mask;
+static size_t ready_cnt;                /* Threads in the run queue. */
 
-// Lab 1. New list defined
-// 1-1. Alarm clock
-// List of sleep processes
-static struct list sleep_list;
+static int ready_max_priority (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -43,7 +47,7 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
-int load_avg;
+fixed_t load_avg;
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
@@ -81,16 +85,16 @@ static tid_t allocate_tid (void);
 
 // Lab 1. New functions implemented 
 // 1-1. Alarm clock 
-bool compare_tick_wakeup(const struct list_elem *e1, const struct list_elem *e2, void *aux)
+// Timer event handler that wakes the thread sleeping on it.
+static void thread_wakeup(void *t)
 {
-  struct thread* thread1 = list_entry(e1, struct thread, elem);
-  struct thread* thread2 = list_entry(e2, struct thread, elem);
-  return thread1->tick_wakeup < thread2->tick_wakeup; // if thread1 has less wakeup tick, return true
+  thread_unblock(t);
 }
 
 void thread_sleep(int64_t tick)
 {
   enum intr_level old; 
+  struct timer_event wakeup; // lives on our stack until we are woken
   old = intr_disable(); // disable interrupts
 
   struct thread *current; 
@@ -99,30 +103,13 @@ void thread_sleep(int64_t tick)
   ASSERT (current != idle_thread); // ensure the current thread is not idle thread
 
   current->tick_wakeup = tick; // store the wakeup tick
-  list_insert_ordered(&sleep_list, &current->elem, compare_tick_wakeup, NULL); // add to the sleep list, list_insert_ordered
+  timer_event_init(&wakeup, thread_wakeup, current);
+  timer_event_add(&wakeup, tick); // O(1) insert into the timer wheel
   thread_block(); // block the current thread
 
   intr_set_level(old); // re-enable interrupts
 }
 
-void thread_awake(int64_t tick)
-{
-  struct list_elem *now_e; // element to check for wakeup tick
-  for(now_e = list_begin(&sleep_list); now_e != list_end(&sleep_list); ) // traverse the sleep_list
-  {
-    struct thread *now_t; 
-    now_t = list_entry(now_e, struct thread, elem); // access the thread structure from the list element
-
-    if(now_t->tick_wakeup > tick) // if it's not time to wake up yet
-    {
-      break;  // move to the next element
-    }
-    // we should awake this thread
-    now_e = list_remove(now_e); // remove from the sleep list
-    thread_unblock(now_t); // unblock the thread
-  }
-}
-
 // 1-2. Priority scheduler 
 // Compare priority of two threads.
 // If first one has higher priority, return True. Otw, False.
@@ -133,22 +120,88 @@ bool compare_priority(const struct list_elem *e1, const struct list_elem *e2, vo
   return priority1 > priority2;
 }
 
-// Compare current thread's priority to the priority of ready_list's front thread.
+// Compare current thread's priority to the highest priority in the run queue.
 // If current thread's priority is lower, call thread_yield() and yield CPU */
 void thread_yield_on_priority(void)
 {
-  if(list_empty(&ready_list)) {
+  if(ready_mask == 0) {
     return;
   }
   else if(!intr_context()) {  // Lab 2-2 - Modified
     struct thread *cur = thread_current();
-    struct thread *ready = list_entry(list_front(&ready_list), struct thread, elem);
-    if(ready->priority > cur->priority) {
+    if(ready_max_priority() > cur->priority) {
       thread_yield();
     }
   }
 }
 
+/* Returns the highest priority of any thread in the run queue,
+   or PRI_MIN - 1 if it is empty. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_mask >> 32, low = ready_mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return PRI_MIN - 1;
+}
+
+/* Appends T to the run queue at its current priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (t->priority >= PRI_MIN && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_lists[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes T from the run queue.  Interrupts must be off. */
+static void
+ready_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  if (list_empty (&ready_lists[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Returns true if the CPU has nothing to do: the idle thread
+   is running and no other thread is ready.  Interrupts must be
+   off. */
+bool
+thread_is_idle (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return idle_thread != NULL && running_thread () == idle_thread
+         && ready_mask == 0;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue list if it is ready to run. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
+}
+
 // Donate if current thread has higher priority than holder of its waiting lock.
 void priority_donation(void)
 {
@@ -162,7 +215,7 @@ void priority_donation(void)
     else {
       struct thread *holder_t = current_t->waiting_lock->holder;
       if(current_t->priority > holder_t->priority) { 
-        holder_t->priority = current_t->priority;
+        thread_change_priority(holder_t, current_t->priority);
       }
       current_t = holder_t;
     }
@@ -208,22 +261,35 @@ void priority_update(void)
 }
 
 // 1-3. Advanced scheduler
+// Recompute priority of T from its recent_cpu and nice, moving it between run queue lists as needed.
+static void mlfqs_update_priority(struct thread *t) {
+  if(t != idle_thread){
+    int priority = PRI_MAX - x_to_int_nearest(div_x_n(t->recent_cpu, 4)) - t->nice * 2;
+    if(priority > PRI_MAX) {priority = PRI_MAX;}
+    if(priority < PRI_MIN) {priority = PRI_MIN;}
+    thread_change_priority(t, priority);
+  }
+}
+
+// Between the once-per-second decays only the running thread's recent_cpu changes,
+// so it is the only thread whose priority needs recomputing every fourth tick.
 void mlfqs_priority(void) {
-  struct list_elem *e;
-  for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
-    struct thread* now = list_entry(e, struct thread, allelem);
-    if(now != idle_thread){
-      now->priority = sub_x_y(sub_x_y(PRI_MAX, x_to_int_nearest(div_x_n(now->recent_cpu, 4))), mul_x_n(now->nice, 2));
-    }
+  struct thread *cur = thread_current();
+  mlfqs_update_priority(cur);
+  if(ready_max_priority() > cur->priority) {
+    intr_yield_on_return();
   }
 }
 
+// Decay recent_cpu of every thread and recompute its priority in the same pass.
 void mlfqs_recent_cpu(void) {
   struct list_elem *e;
+  fixed_t coef = div_x_y(mul_x_n(load_avg,2), add_x_n((mul_x_n(load_avg, 2)),1));
   for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
     struct thread* now = list_entry(e, struct thread, allelem);
     if(now != idle_thread){
-      now->recent_cpu = add_x_n(mul_x_y(div_x_y(mul_x_n(load_avg,2), add_x_n((mul_x_n(load_avg, 2)),1)),now->recent_cpu), now->nice);
+      now->recent_cpu = add_x_n(mul_x_y(coef, now->recent_cpu), now->nice);
+      mlfqs_update_priority(now);
     }
   }
 }
@@ -236,11 +302,11 @@ void mlfqs_recent_cpu_increase(void) {
 
 void mlfqs_load_avg(void) {
   struct thread* now = thread_current();
-  int mid= mul_x_y(div_x_y(n_to_fp(59), n_to_fp(60)), load_avg);
+  fixed_t mid = mul_x_y(FP_FRAC(59, 60), load_avg);
   int ready_threads;
-  if(now == idle_thread) {ready_threads=list_size(&ready_list);}
-  else {ready_threads=list_size(&ready_list)+1;}
-  load_avg = add_x_y(mid, mul_x_n(div_x_y(n_to_fp(1),n_to_fp(60)), ready_threads));
+  if(now == idle_thread) {ready_threads=ready_cnt;}
+  else {ready_threads=ready_cnt+1;}
+  load_avg = add_x_y(mid, mul_x_n(FP_FRAC(1, 60), ready_threads));
 }
 // END Lab 1. New functions implemented
 
@@ -261,11 +327,15 @@ void mlfqs_load_avg(void) {
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
-  list_init (&sleep_list); // Lab 1-1.
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_lists[i]);
+  ready_mask = 0;
+  ready_cnt = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -434,8 +504,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  //list_push_back (&ready_list, &t->elem);
-  list_insert_ordered (&ready_list, &t->elem, compare_priority, NULL); // Lab 1-2.
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -483,7 +552,6 @@ thread_exit (void)
 
 #ifdef USERPROG
   process_exit ();
-#endif
 
   /* Lab 2-3 */
   struct thread* now = thread_current();
@@ -493,6 +561,7 @@ thread_exit (void)
   }
   sema_down(&(now->sema_exit));
   /* END Lab 2-3 */
+#endif
   
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -517,8 +586,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    //list_push_back (&ready_list, &cur->elem); 
-    list_insert_ordered (&ready_list, &cur->elem, compare_priority, NULL); // Lab 1-2.
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -561,9 +629,13 @@ thread_get_priority (void)
 // Lab 1-3. Function edited
 /* Sets the current thread's nice value to NICE. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
+  enum intr_level old_level = intr_disable ();
   thread_current()->nice=nice; // Lab 1-3.
+  if(thread_mlfqs) {mlfqs_update_priority(thread_current());}
+  intr_set_level (old_level);
+  thread_yield_on_priority();
 }
 
 /* Returns the current thread's nice value. */
@@ -689,9 +761,11 @@ init_thread (struct thread *t, const char *name, int priority)
   t->recent_cpu=0;
   // END Lab 1-3.
 
+#ifdef USERPROG
   /* Lab 2-3 */
   list_init(&(t->child_list));
   /* END Lab 2-3 */
+#endif
 
   /* Lab 3-5 */
   list_init(&(t->mmap_list));
@@ -724,10 +798,15 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_mask == 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = list_entry (list_front (&ready_lists[ready_max_priority ()]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -759,6 +838,11 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Resume regular ticks if the timer was left counting down a
+     long idle period. */
+  if (prev == idle_thread)
+    timer_leave_idle ();
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
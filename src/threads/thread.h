@@ -8,7 +8,7 @@
 /* Lab 2-3 Header added */
 #include "threads/synch.h"
 /* Lab 3-3 Header added */
-#include <hash.h>
+#include "vm/page.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -99,9 +99,15 @@ struct thread
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
     // Lab 3 Variable added
-    struct hash vm;
+    struct vm_map vm;                   /* Supplemental page table. */
     struct list mmap_list;
     int mmap_next;
+    size_t rss;                         /* Frames mapped (vm/frame.c). */
+    unsigned fault_rate;                /* Faults that loaded a page in the
+                                           last second (vm/frame.c). */
+    unsigned fault_window_cnt;          /* Such faults this second so far. */
+    int64_t fault_window;               /* Tick this second began. */
+    bool oom_killed;                    /* Exit on next kernel entry. */
 #ifdef USERPROG
     /* Owned by userprog/process.c. */ 
     uint32_t *pagedir;                  /* Page directory. */
@@ -129,10 +135,11 @@ struct thread
    struct list donation_list;
    struct list_elem donation_elem;
    struct lock *waiting_lock;
+   struct rwlock_reader read_locks[RWLOCK_READ_MAX]; /* Read-held rwlocks. */
 
    // Lab 1-3. Variable added
    int nice;
-   int recent_cpu;
+   int recent_cpu;                      /* Fixed-point (see fixed_point_operation.h). */
   };
 
 /* If false (default), use round-robin scheduler.
@@ -142,13 +149,13 @@ extern bool thread_mlfqs;
 
 // Lab 1. New functions implemented
 // 1-1. Alarm clock
-bool compare_tick_wakeup(const struct list_elem *e1, const struct list_elem *e2, void *aux);
 void thread_sleep(int64_t tick);
-void thread_awake(int64_t tick);
 
 // 1-2. Priority scheduler
 bool compare_priority(const struct list_elem *e1, const struct list_elem *e2, void *aux);
 void thread_yield_on_priority(void);
+void thread_change_priority (struct thread *, int priority);
+bool thread_is_idle (void);
 
 void priority_donation(void);
 void delete_from_donation_list(struct lock *lock);
@@ -157,6 +157,10 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* Picked to free memory when it ran out. */
+  if (user && thread_current ()->oom_killed)
+    syscall_exit (-1);
+
    /* Lab 2-3 
    if(user) {
       syscall_exit(-1);
@@ -165,7 +169,18 @@ page_fault (struct intr_frame *f)
 
    /* Lab 3-2 */
    if(!not_present) {
-      syscall_exit(-1);
+      // a write to a writable page shared copy-on-write after fork()
+      struct vm_entry *cow = find_vme(fault_addr);
+      if(!write || cow == NULL || !cow->writable) {
+         syscall_exit(-1);
+      }
+      lock_acquire(&frame_lock);
+      bool copied = frame_break_cow(cow);
+      lock_release(&frame_lock);
+      if(!copied) {
+         syscall_exit(-1);
+      }
+      return;
    }
    struct vm_entry *vme = find_vme(fault_addr);
    if(vme) {
@@ -8,12 +8,14 @@
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -25,13 +27,18 @@
 #include "vm/swap.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
-/* Lab 2-3 Variable added */
-extern struct lock f_lock;
 /* Lab 3-2 Variable added */
 extern struct lock frame_lock;
 
+/* Pages in the aligned window mapped around a file page fault,
+   set by the -fault-around kernel command line option.  0 or 1
+   maps only the faulting page. */
+static size_t fault_around_pages = 16;
+#define FAULT_AROUND_MAX 64
+
 
 /* Lab 2-2 Function added */
 /* store name and arguments in the user stack */
@@ -197,6 +204,249 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Handed from process_fork() to the child, on the parent's
+   stack; the parent stays blocked on the child's sema_load for
+   as long as the child uses it. */
+struct fork_aux
+  {
+    struct intr_frame if_;              /* Parent's registers at the syscall. */
+    struct thread *parent;
+  };
+
+/* Creates a child process that is a copy of the current one,
+   resuming from the system call interrupt frame F with 0 in
+   EAX.  The parent's pages are not copied: the child maps the
+   same frames read-only and whichever process writes to one
+   first gets its own copy in page_fault().  Returns the child's
+   pid, or -1 if it could not be created. */
+pid_t
+process_fork (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct fork_aux aux;
+  tid_t tid;
+
+  aux.if_ = *f;
+  aux.parent = cur;
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &aux);
+  if (tid == TID_ERROR)
+    return -1;
+
+  struct thread *child = get_pd_child (tid);
+  sema_down (&child->sema_load);
+  if (!child->is_loaded)
+    return -1;
+  return tid;
+}
+
+/* Makes VME, in the current thread's page table, a copy of the
+   parent's page SRC, backed by FILE instead of the parent's file.
+   Resident anonymous and executable pages become shared with
+   the parent; pages swapped out share the swap slot.  Must be
+   called with frame_lock held. */
+static bool
+fork_page (struct vm_entry *vme, struct vm_entry *src, struct file *file)
+{
+  struct thread *cur = thread_current ();
+  frame_wait_evicted (src);
+  memcpy (vme, src, sizeof *vme);
+  vme->file = file;
+  vme->is_loaded = false;
+  vme->thread = cur;
+
+  if (src->is_loaded && src->type == VM_ZERO)
+    {
+      /* Never written, so the child maps the zero page itself
+         when it first touches it. */
+    }
+  else if (src->is_loaded && src->type == VM_FILE)
+    {
+      /* A mapped file is shared through the file itself, and
+         fork_write_back() has written the parent's changes back
+         for the child to fault in. */
+    }
+  else if (src->is_loaded)
+    {
+      if (!frame_share (src, vme))
+        return false;
+    }
+  else if (src->type == VM_ANON)
+    swap_dup (src->swap_slot);
+  return true;
+}
+
+/* Copies the parent's region SRC and the pages in it into the
+   current thread, backed by FILE.  Must be called with
+   frame_lock held. */
+static struct vm_region *
+fork_region (struct vm_region *src, struct file *file)
+{
+  struct vm_region *r = vm_add_region (&thread_current ()->vm, src->start,
+                                       src->page_cnt);
+  size_t i;
+
+  if (r == NULL)
+    return NULL;
+  r->mapid = src->mapid;
+  for (i = 0; i < src->page_cnt; i++)
+    if (src->pages[i].vaddr != NULL)
+      {
+        struct vm_entry *vme = vm_claim_page (r, src->pages[i].vaddr);
+        if (!fork_page (vme, &src->pages[i], file))
+          {
+            /* Not mapped yet, so there is nothing to release. */
+            vme->vaddr = NULL;
+            return NULL;
+          }
+      }
+  return r;
+}
+
+/* Writes PARENT's dirty mapped file pages back to their files,
+   so that the child, which maps the files through its own struct
+   file, sees the parent's changes.  Each page's frame is pinned
+   and its dirty bit cleared under frame_lock, and the write is
+   done with the lock released.  PARENT is waiting for the fork
+   to finish, so it cannot dirty the pages again meanwhile. */
+static void
+fork_write_back (struct thread *parent)
+{
+  uint32_t *pd = parent->pagedir;
+  struct list_elem *e;
+  size_t i;
+
+  for (e = list_begin (&parent->mmap_list); e != list_end (&parent->mmap_list);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct mmap_file, elem)->region;
+      for (i = 0; r != NULL && i < r->page_cnt; i++)
+        {
+          struct vm_entry *src = &r->pages[i];
+          struct frame *f;
+          void *kaddr;
+
+          if (src->vaddr == NULL)
+            continue;
+          lock_acquire (&frame_lock);
+          frame_wait_evicted (src);
+          if (!src->is_loaded || !pagedir_is_dirty (pd, src->vaddr))
+            {
+              lock_release (&frame_lock);
+              continue;
+            }
+          kaddr = pagedir_get_page (pd, src->vaddr);
+          f = kaddr_to_frame (kaddr);
+          f->pinned++;
+          pagedir_set_dirty (pd, src->vaddr, false);
+          lock_release (&frame_lock);
+
+          file_write_at (src->file, kaddr, src->read_bytes, src->offset);
+
+          lock_acquire (&frame_lock);
+          f->pinned--;
+          lock_release (&frame_lock);
+        }
+    }
+}
+
+/* Copies PARENT's open files and memory mappings, then its
+   supplemental page table, into the current thread. */
+static bool
+fork_resources (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+  int fd;
+
+  if (parent->f_now != NULL)
+    {
+      cur->f_now = file_reopen (parent->f_now);
+      if (cur->f_now == NULL)
+        return false;
+      file_deny_write (cur->f_now);
+    }
+
+  /* File descriptors get their own struct file, positioned where
+     the parent's is. */
+  for (fd = 2; fd < parent->fd_num; fd++)
+    {
+      struct file *file = parent->fd_table[fd];
+      cur->fd_table[fd] = NULL;
+      cur->fd_num = fd + 1;
+      if (file == NULL)
+        continue;
+      cur->fd_table[fd] = file_reopen (file);
+      if (cur->fd_table[fd] == NULL)
+        return false;
+      file_seek (cur->fd_table[fd], file_tell (file));
+    }
+
+  fork_write_back (parent);
+  lock_acquire (&frame_lock);
+  for (e = list_begin (&parent->vm.regions); e != list_end (&parent->vm.regions);
+       e = list_next (e))
+    {
+      struct vm_region *r = list_entry (e, struct vm_region, elem);
+      if (r->mapid == 0 && fork_region (r, cur->f_now) == NULL)
+        goto fail;
+    }
+
+  for (e = list_begin (&parent->mmap_list); e != list_end (&parent->mmap_list);
+       e = list_next (e))
+    {
+      struct mmap_file *pmmf = list_entry (e, struct mmap_file, elem);
+      struct mmap_file *mmf = calloc (1, sizeof *mmf);
+
+      if (mmf == NULL)
+        goto fail;
+      mmf->mapid = pmmf->mapid;
+      mmf->file = file_reopen (pmmf->file);
+      list_push_back (&cur->mmap_list, &mmf->elem);
+      if (mmf->file == NULL)
+        goto fail;
+      mmf->region = fork_region (pmmf->region, mmf->file);
+      if (mmf->region == NULL)
+        goto fail;
+    }
+  cur->mmap_next = parent->mmap_next;
+  lock_release (&frame_lock);
+  return true;
+
+ fail:
+  cur->mmap_next = parent->mmap_next;
+  lock_release (&frame_lock);
+  return false;
+}
+
+/* A thread function that turns a new thread into a copy of the
+   process that called process_fork() and starts it running. */
+static void
+start_fork (void *aux_)
+{
+  struct fork_aux *aux = aux_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_ = aux->if_;
+  bool success = false;
+
+  vm_init (&cur->vm);
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir != NULL)
+    {
+      process_activate ();
+      success = fork_resources (aux->parent);
+    }
+
+  /* AUX is gone once the parent wakes up. */
+  cur->is_loaded = success;
+  sema_up (&cur->sema_load);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Lab 2-3 Function modified */
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
@@ -236,8 +486,6 @@ process_exit (void)
     syscall_close(i);
   }
   palloc_free_page(cur->fd_table);
-
-  file_close(cur->f_now);
   /* END Lab 2-3 */
 
   /* Lab 3-7 */
@@ -246,6 +494,11 @@ process_exit (void)
   vm_destroy(&cur->vm);
   /* END Lab 3-7 */
 
+  /* Close the executable only after its pages are unmapped, so
+     that its inode number is not reused while the page cache
+     still holds frames keyed by it. */
+  file_close(cur->f_now);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -370,19 +623,15 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
-  /* Lab 2-4 */
-  lock_acquire(&f_lock);    // Lab 2-4
   /* Open executable file. */
   file = filesys_open (file_name);
   if (file == NULL) 
     { 
       printf ("load: %s: open failed\n", file_name);
-      lock_release(&f_lock);  // Lab 2-4
       goto done; 
     }
   t->f_now = file;             // Lab 2-4
   file_deny_write(file);          // Lab 2-4
-  lock_release(&f_lock);    // Lab 2-4
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -544,6 +793,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+  /* Lab 3-2: one region holds the whole segment's pages. */
+  struct vm_region *r = vm_add_region (&thread_current ()->vm, upage,
+                                       (read_bytes + zero_bytes) / PGSIZE);
+  if (r == NULL)
+    return false;
+
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -556,12 +811,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       // code removed 
 
       /* Lab 3-2 */
-      struct vm_entry *vme = (struct vm_entry *)malloc(sizeof(struct vm_entry));
-      if(!vme) {
-        return false;
-      }
-      memset(vme, 0, sizeof(struct vm_entry));
-      vme->type = VM_BIN;
+      struct vm_entry *vme = vm_claim_page(r, upage);
+      // a page with nothing to read is zero-fill: no frame until written
+      vme->type = page_read_bytes == 0 ? VM_ZERO : VM_BIN;
       vme->vaddr = upage;
       vme->writable = writable;
       vme->is_loaded = false;
@@ -569,7 +821,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       vme->offset = ofs;
       vme->read_bytes = page_read_bytes;
       vme->zero_bytes = page_zero_bytes;
-      insert_vme(&thread_current()->vm, vme);
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
@@ -588,13 +839,10 @@ setup_stack (void **esp)
   lock_acquire(&frame_lock);
   struct frame* frame = allocate_frame(PAL_USER | PAL_ZERO);
   bool success=false;
-  if (frame->phy_addr != NULL) {
+  if (frame != NULL) {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, frame->phy_addr, true);
-      if (success) {
-	        struct vm_entry* vme = (struct vm_entry*)malloc(sizeof(struct vm_entry));
-	        if (!vme) 
-		        return NULL;
-	        memset(vme, 0, sizeof(struct vm_entry));
+      struct vm_entry *vme = success ? vm_stack_page(((uint8_t *) PHYS_BASE) - PGSIZE) : NULL;
+      if (vme != NULL) {
         	vme->type = VM_ANON;
 	        vme->vaddr = ((uint8_t *)PHYS_BASE) - PGSIZE;
 	        vme->writable = true;
@@ -603,15 +851,13 @@ setup_stack (void **esp)
 	        vme->offset = NULL;
 	        vme->read_bytes = 0;
 	        vme->zero_bytes = 0;
-          frame->frame_mapped_page=vme;
-          if (!frame->frame_mapped_page) {
-            lock_release(&frame_lock);
-            return false;
-          }
-          insert_vme(&thread_current()->vm, frame->frame_mapped_page);
+          frame_map(frame, vme);
           *esp = PHYS_BASE;
         } 
       else {
+        if (success)
+          pagedir_clear_page (thread_current ()->pagedir, ((uint8_t *) PHYS_BASE) - PGSIZE);
+        success = false;
         free_frame (frame->phy_addr);
       }
     }
@@ -639,12 +885,45 @@ install_page (void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
+/* Sets the fault-around window to PAGES pages, at most
+   FAULT_AROUND_MAX. */
+void process_set_fault_around(size_t pages)
+{
+  fault_around_pages = pages < FAULT_AROUND_MAX ? pages : FAULT_AROUND_MAX;
+}
+
 /* Lab 3-2 Function added */
-bool handle_mm_fault(struct vm_entry *vme)
+/* Loads VME's page into a frame and maps it; frame_lock must be
+   held. */
+static bool map_page(struct vm_entry *vme)
 {
-  lock_acquire(&frame_lock);
-  struct frame *f = allocate_frame(PAL_USER);
-  f->frame_mapped_page = vme;
+  // a read-only file page another process already has in memory
+  struct frame *f = frame_cache_lookup(vme);
+  if(f != NULL) {
+    if(!install_page(vme->vaddr, f->phy_addr, false)) {
+      return false;
+    }
+    vme->is_loaded = true;
+    frame_map(f, vme);
+    return true;
+  }
+
+  if(vme->type == VM_ZERO) {
+    // map the shared zero page until the first write
+    if(!install_page(vme->vaddr, frame_zero_page(), false)) {
+      return false;
+    }
+    vme->is_loaded = true;
+    vme->thread = thread_current();
+    return true;
+  }
+  if(vme->type != VM_BIN && vme->type != VM_FILE && vme->type != VM_ANON) {
+    return false;
+  }
+  f = allocate_frame(PAL_USER);
+  if(f == NULL) {
+    return false;
+  }
   bool success = false;
   // load to the physical memory
   switch(vme->type) {
@@ -657,32 +936,134 @@ bool handle_mm_fault(struct vm_entry *vme)
     case VM_ANON:
       success = swap_in(vme->swap_slot, f->phy_addr);
       break;
-    default:
-      lock_release(&frame_lock);
-      return false;
   }
   if(!success) {
     free_frame(f->phy_addr);
-    lock_release(&frame_lock);
     return false;
   }
   // mapping
   if(!install_page(vme->vaddr, f->phy_addr, vme->writable)) {
     free_frame(f->phy_addr);
-    lock_release(&frame_lock);
     return false;
   }
   // successfully loaded & mapped
   vme->is_loaded = true;
-  lock_release(&frame_lock);
+  frame_map(f, vme);
+  frame_cache_insert(f, vme);
   return true;
 }
 
+/* Maps the not yet loaded pages of VME's file that surround it
+   in the fault-around window, so that a sequential scan of code
+   or of a mapped file takes one fault per window rather than one
+   per page.  Pages already in the page cache are mapped at once.
+   The rest get frames, pinned and not yet mapped, and are read
+   with frame_lock released, so that other processes' faults and
+   evictions do not queue up behind speculative reads.  Stops as
+   soon as free frames run short; the extra pages are left
+   unaccessed, so the clock reclaims them first if they go
+   unused.  frame_lock must be held. */
+static void fault_around(struct vm_entry *vme)
+{
+  struct vm_entry *pages[FAULT_AROUND_MAX];
+  struct frame *frames[FAULT_AROUND_MAX];
+  size_t window = fault_around_pages * PGSIZE;
+  size_t cnt = 0, i;
+  uint8_t *start, *end, *upage;
+
+  if(fault_around_pages < 2 || (vme->type != VM_BIN && vme->type != VM_FILE)) {
+    return;
+  }
+  start = (uint8_t *) ((uintptr_t) vme->vaddr / window * window);
+  end = start + window;
+  if(start < (uint8_t *) PGSIZE) {
+    start = (uint8_t *) PGSIZE;
+  }
+  for(upage = start; upage < end && is_user_vaddr(upage); upage += PGSIZE) {
+    struct vm_entry *n = find_vme(upage);
+    if(n == NULL || n == vme || n->is_loaded || n->file != vme->file
+       || (n->type != VM_BIN && n->type != VM_FILE)) {
+      continue;
+    }
+    struct frame *f = frame_cache_lookup(n);
+    if(f != NULL) {
+      if(install_page(n->vaddr, f->phy_addr, false)) {
+        n->is_loaded = true;
+        frame_map(f, n);
+      }
+      continue;
+    }
+    if(!frame_spare()) {
+      break;
+    }
+    f = allocate_frame(PAL_USER);
+    if(f == NULL) {
+      break;
+    }
+    // no mappings yet, so the clock passes it over; the pin keeps it that way
+    f->pinned++;
+    pages[cnt] = n;
+    frames[cnt++] = f;
+  }
+  if(cnt == 0) {
+    return;
+  }
+
+  // only this thread loads its own pages, so they stay unloaded meanwhile
+  lock_release(&frame_lock);
+  bool loaded[FAULT_AROUND_MAX];
+  for(i = 0; i < cnt; i++) {
+    loaded[i] = load_file(frames[i]->phy_addr, pages[i]);
+  }
+  lock_acquire(&frame_lock);
+
+  for(i = 0; i < cnt; i++) {
+    frames[i]->pinned--;
+    if(!loaded[i] || !install_page(pages[i]->vaddr, frames[i]->phy_addr, pages[i]->writable)) {
+      free_frame(frames[i]->phy_addr);
+      continue;
+    }
+    pages[i]->is_loaded = true;
+    frame_map(frames[i], pages[i]);
+    frame_cache_insert(frames[i], pages[i]);
+  }
+}
+
+/* Counts a fault that loads a page against T, keeping its fault
+   rate as the number of such faults in the last full second, which
+   the clock uses to leave a thrashing thread's frames alone. */
+static void count_fault(struct thread *t)
+{
+  int64_t now = timer_ticks();
+  if(now - t->fault_window >= TIMER_FREQ) {
+    t->fault_rate = now - t->fault_window < 2 * TIMER_FREQ ? t->fault_window_cnt : 0;
+    t->fault_window_cnt = 0;
+    t->fault_window = now;
+  }
+  t->fault_window_cnt++;
+}
+
+bool handle_mm_fault(struct vm_entry *vme)
+{
+  lock_acquire(&frame_lock);
+  // the page may be on its way out to disk; it has to get there first
+  frame_wait_evicted(vme);
+  if(vme->is_loaded) {
+    lock_release(&frame_lock);
+    return true;
+  }
+  count_fault(thread_current());
+  bool success = map_page(vme);
+  if(success) {
+    fault_around(vme);
+  }
+  lock_release(&frame_lock);
+  return success;
+}
+
 bool load_file(void *kaddr, struct vm_entry *vme)
 { 
-  lock_acquire(&f_lock);  
   int read_bytes = file_read_at(vme->file, kaddr, vme->read_bytes, vme->offset);
-  lock_release(&f_lock);
   if(read_bytes != (int)vme->read_bytes) {
     return false;
   }
@@ -718,10 +1099,13 @@ bool expand_stack(void *addr)
       return is_mapped;
     }
     else {
-      struct vm_entry* vme = (struct vm_entry*)malloc(sizeof(struct vm_entry));
-    	if (!vme) 
-		    return NULL;
-	    memset(vme, 0, sizeof(struct vm_entry));
+      struct vm_entry *vme = vm_stack_page(upage);
+      if (!vme) {
+        pagedir_clear_page(thread_current()->pagedir, upage);
+        free_frame(frame->phy_addr);
+        lock_release(&frame_lock);
+        return false;
+      }
 	    vme->type = VM_ANON;
 	    vme->vaddr = upage;
 	    vme->writable = true;
@@ -730,12 +1114,7 @@ bool expand_stack(void *addr)
 	    vme->offset = NULL;
 	    vme->read_bytes = 0;
 	    vme->zero_bytes = 0;
-      frame->frame_mapped_page= vme;
-      if (!frame->frame_mapped_page) {
-        lock_release(&frame_lock);
-        return false;
-      }
-      insert_vme(&thread_current()->vm, frame->frame_mapped_page);
+      frame_map(frame, vme);
       lock_release(&frame_lock);
       return is_mapped;
     }
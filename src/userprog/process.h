@@ -2,6 +2,7 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 /* Lab 3-2 Header added */
 #include "vm/frame.h"
 #include "vm/page.h"
@@ -18,12 +19,14 @@ void argument_stack(char *file_name, void **esp);
 struct thread* get_pd_child(pid_t pid);
 
 tid_t process_execute (const char *file_name);
+pid_t process_fork (struct intr_frame *f);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
 /* Lab 3-2 Function added */
 bool handle_mm_fault(struct vm_entry *vme);
+void process_set_fault_around(size_t pages);
 bool load_file(void *kaddr, struct vm_entry *vme);
 
 /* Lab 3-4 Function added */
@@ -15,11 +15,10 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include <list.h>
+#include <round.h>
 
 static void syscall_handler (struct intr_frame *);
 
-/* Lab 2-3 Variable added */
-struct lock f_lock;
 /* Lab 3-5 Variable added */
 extern struct lock frame_lock;
 
@@ -87,35 +86,34 @@ int syscall_wait(pid_t pid)
   return process_wait(pid);
 }
 
+pid_t syscall_fork(struct intr_frame *f)
+{
+  return process_fork(f);
+}
+
 bool syscall_create(const char *file, unsigned initial_size)
 { 
   addr_check((void*)file);
   if(file == NULL) {
     syscall_exit(-1);
   }  
-  lock_acquire(&f_lock);
   bool success = filesys_create(file, initial_size);
-  lock_release(&f_lock);
   return success;
 }
 
 bool syscall_remove(const char *file)
 { 
   addr_check((void*)file);
-  lock_acquire(&f_lock);
   bool success = filesys_remove(file);
-  lock_release(&f_lock);
   return success;
 }
 
 int syscall_open(const char *file)
 {
   addr_check((void*)file);
-  lock_acquire(&f_lock);
 
   struct file* f = filesys_open(file);
   if(!f) {
-    lock_release(&f_lock);
     return -1;
   }
 
@@ -128,7 +126,6 @@ int syscall_open(const char *file)
   now->fd_num++;
   now->fd_table[fd] = f;
 
-  lock_release(&f_lock);
   return fd;
 }
 
@@ -138,9 +135,7 @@ int syscall_filesize(int fd)
   if(f == NULL) {
     return -1;
   }
-  lock_acquire(&f_lock);
   int size = file_length(f);  // return filesize
-  lock_release(&f_lock);
   return size;
 }
 
@@ -150,7 +145,7 @@ int syscall_read(int fd, void *buffer, unsigned size, void *esp)
     addr_check(buffer+i);
   }
   // pin & unpin
-  pin_buffer(buffer, size, esp);
+  pin_buffer(buffer, size, esp, true);
   int r_bytes = 0; // bytes read
   if(fd==0) { // if fd is 0, not file. console
     for (int j = 0; j < size; j++) {
@@ -166,9 +161,7 @@ int syscall_read(int fd, void *buffer, unsigned size, void *esp)
     if(!f) {
       return -1;
     }
-    lock_acquire(&f_lock);
     r_bytes = file_read(f, buffer, size);
-    lock_release(&f_lock);
   }
   unpin_buffer(buffer, size);
 
@@ -181,13 +174,11 @@ int syscall_write(int fd, const void *buffer, unsigned size, void *esp)
     addr_check(buffer+i);
   }
   // pin & unpin
-  pin_buffer(buffer, size, esp);
+  pin_buffer(buffer, size, esp, false);
   int w_bytes = 0;
   if(fd == 1)
   {
-    lock_acquire(&f_lock);
     putbuf(buffer, size);
-    lock_release(&f_lock);
     w_bytes = size;
   }
   else if(fd > 1)
@@ -196,9 +187,7 @@ int syscall_write(int fd, const void *buffer, unsigned size, void *esp)
     if(!f) {
       return -1;
     }
-    lock_acquire(&f_lock);
     w_bytes += file_write(f, buffer, size);
-    lock_release(&f_lock);
   }
   unpin_buffer(buffer, size);
 
@@ -210,23 +199,19 @@ void syscall_seek(int fd, unsigned position)
 {
   struct file* f = get_fd_file(fd);
   if(f == NULL) {return;}
-  lock_acquire(&f_lock);
   file_seek(f, position);
-  lock_release(&f_lock);
 }
 
 unsigned syscall_tell(int fd)
 {
   unsigned position;
   struct file *f = get_fd_file(fd);
-  lock_acquire(&f_lock);
   if (f) {
     position = file_tell(f);
   }
   else {
     position = 0;
   }
-  lock_release(&f_lock);
   return position;
 }
 
@@ -249,7 +234,6 @@ void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&f_lock);
 }
 
 /* Lab 2-3 & 3-5 Function modified */
@@ -259,6 +243,9 @@ syscall_handler (struct intr_frame *f UNUSED)
   //printf ("system call!\n");
   //thread_exit ();
   /* check if the stack pointer is valid */
+  if(thread_current()->oom_killed) { // picked to free memory when it ran out
+    syscall_exit(-1);
+  }
   for(int i = 0; i < 3; i++) {
     addr_check(f->esp + 4*i);
   }
@@ -325,6 +312,9 @@ syscall_handler (struct intr_frame *f UNUSED)
       syscall_munmap(argv[0]);
       break;
     /* END Lab 3-5 */
+    case SYS_FORK:
+      f->eax = syscall_fork(f);
+      break;
     default:
       syscall_exit(-1);
   }
@@ -355,21 +345,20 @@ mapid_t syscall_mmap(int fd, void* addr)
   mmf->mapid = t->mmap_next++;
   list_push_back(&t->mmap_list, &mmf->elem);
 
-  lock_acquire(&f_lock);
   mmf->file = file_reopen(f);
-  lock_release(&f_lock);
   
-  list_init(&mmf->vme_list);
   int _file_length = file_length(mmf->file);
+  // one region for the whole file; fails if any page of it is taken
+  mmf->region = vm_add_region(&t->vm, addr, DIV_ROUND_UP(_file_length, PGSIZE));
+  if(mmf->region == NULL) {
+    list_remove(&mmf->elem);
+    file_close(mmf->file);
+    free(mmf);
+    return -1;
+  }
+  mmf->region->mapid = mmf->mapid;
   while(_file_length > 0) {
-    if(find_vme(addr)) {
-      return -1;
-    }
-    struct vm_entry *vme = (struct vm_entry *)malloc(sizeof(struct vm_entry));
-    if(!vme) {
-      return -1;
-    }
-    memset(vme, 0, sizeof(struct vm_entry));
+    struct vm_entry *vme = vm_claim_page(mmf->region, addr);
 
     size_t _read_bytes = _file_length < PGSIZE ? _file_length : PGSIZE;
     size_t _zero_bytes = PGSIZE - _read_bytes;
@@ -382,9 +371,6 @@ mapid_t syscall_mmap(int fd, void* addr)
     vme->offset = offset;
     vme->read_bytes = _read_bytes;
     vme->zero_bytes = _zero_bytes;
-    
-    list_push_back(&mmf->vme_list, &vme->mmap_elem);
-    insert_vme(&t->vm, vme);
 
     addr += PGSIZE;
     offset += PGSIZE;
@@ -400,69 +386,85 @@ void syscall_munmap(mapid_t mapid)
   struct thread *t = thread_current();
   struct list_elem *e;
   for(e = list_begin(&t->mmap_list); e != list_end(&t->mmap_list); e = list_next(e)) {
-    mmf = list_entry(e, struct mmap_file, elem);
-    if(mmf->mapid == mapid) {
+    if(list_entry(e, struct mmap_file, elem)->mapid == mapid) {
+      mmf = list_entry(e, struct mmap_file, elem);
       break;
     }
   }
   if(mmf == NULL) { // no such mmap file
     return;
   }
-  // remove all vm_entry in vme_list
-  for(e = list_begin(&mmf->vme_list); e != list_end(&mmf->vme_list); ) {
-    struct vm_entry *vme = list_entry(e, struct vm_entry, mmap_elem);
-    if(vme->is_loaded && pagedir_is_dirty(t->pagedir, vme->vaddr)) {
-      lock_acquire(&f_lock);
-      file_write_at(vme->file, vme->vaddr, vme->read_bytes, vme->offset);
-      lock_release(&f_lock);
-
-      lock_acquire(&frame_lock);
-      free_frame(pagedir_get_page(t->pagedir, vme->vaddr));
-      lock_release(&frame_lock);
+  // write back and unmap every page of the mapping's region
+  for(size_t i = 0; mmf->region != NULL && i < mmf->region->page_cnt; i++) {
+    struct vm_entry *vme = &mmf->region->pages[i];
+    // write back through the kernel mapping while holding frame_lock so
+    // the page cannot be evicted (and faulted on) under the inode lock
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(vme);
+    if(vme->is_loaded) {
+      void *kaddr = pagedir_get_page(t->pagedir, vme->vaddr);
+      if(pagedir_is_dirty(t->pagedir, vme->vaddr)) {
+        file_write_at(vme->file, kaddr, vme->read_bytes, vme->offset);
+      }
+      frame_unmap(vme);
     }
+    lock_release(&frame_lock);
     vme->is_loaded = false;
-    e = list_remove(e);
-    delete_vme(&t->vm, vme);
+  }
+  if(mmf->region != NULL) {
+    vm_remove_region(&t->vm, mmf->region);
   }
   list_remove(&mmf->elem);
   free(mmf);
 }
 /* END Lab 3-5 */
 
-// for pinning
-void pin_buffer(void *buffer, int size, void *esp)
+// for pinning; WRITE is set when the kernel is about to write to BUFFER
+void pin_buffer(void *buffer, int size, void *esp, bool write)
 {
   void *ptr = buffer;     // buffer pointer
   size_t cur_size = size; 
 
   while (cur_size > 0) {
-    struct vm_entry *vme = find_vme(pg_round_down(ptr));
-    if(vme) {
-      if(!vme->is_loaded) {
+    // the page can be evicted again between the fault and the pin,
+    // so fault until it is still there once frame_lock is held
+    while (true) {
+      struct vm_entry *vme = find_vme(pg_round_down(ptr));
+      if(vme) {
         if(!handle_mm_fault(vme)) {
           syscall_exit(-1);
         }
       }
-    }
-    else {
-      if(!verify_stack(ptr, esp)) {
-        syscall_exit(-1);
+      else {
+        if(!verify_stack(ptr, esp)) {
+          syscall_exit(-1);
+        }
+        if(!expand_stack(ptr)) {
+          syscall_exit(-1);
+        }
       }
-      if(!expand_stack(ptr)) {
-        syscall_exit(-1);
+
+      lock_acquire(&frame_lock);
+      if(write) {
+        // the kernel cannot take a copy-on-write fault, so copy up front
+        vme = find_vme(ptr);
+        if(!vme || !vme->writable || !frame_break_cow(vme)) {
+          lock_release(&frame_lock);
+          syscall_exit(-1);
+        }
+      }
+      struct frame *f = find_frame(pg_round_down(ptr));
+      void *kaddr = pagedir_get_page(thread_current()->pagedir, pg_round_down(ptr));
+      if(f) {
+        pin_frame(f->phy_addr);
+      }
+      if(f || (kaddr != NULL && kaddr == frame_zero_page())) {
+        // (the shared zero page is never evicted, so it needs no pin)
+        lock_release(&frame_lock);
+        break;
       }
-    }
-     
-    lock_acquire(&frame_lock);
-    struct frame *f = find_frame(pg_round_down(ptr));
-    if(!f) {
       lock_release(&frame_lock);
-      syscall_exit(-1);
     }
-    else {
-      pin_frame(f->phy_addr);
-    }
-    lock_release(&frame_lock);
 
     size_t pinned = cur_size > PGSIZE - pg_ofs(ptr) ? PGSIZE - pg_ofs(ptr) : cur_size;
     ptr += pinned;
@@ -478,13 +480,14 @@ void unpin_buffer(void *buffer, int size)
   while (cur_size > 0) {
     lock_acquire(&frame_lock);
     struct frame *f = find_frame(pg_round_down(ptr));
-    if(!f) {
+    if(f) {
+      unpin_frame(f->phy_addr);
+    }
+    else if(pagedir_get_page(thread_current()->pagedir, pg_round_down(ptr)) != frame_zero_page()) {
+      // (the shared zero page is never evicted, so it needs no pin)
       lock_release(&frame_lock);
       syscall_exit(-1);
     }
-    else {
-      unpin_frame(f->phy_addr);
-    }
     lock_release(&frame_lock);
 
     size_t unpinned = cur_size > PGSIZE - pg_ofs(ptr) ? PGSIZE - pg_ofs(ptr) : cur_size;
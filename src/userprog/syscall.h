@@ -3,6 +3,7 @@
 
 /* Lab 2-3 Header & Type definition & Function added */
 #include <stdbool.h>
+#include "threads/interrupt.h"
 
 typedef int pid_t;
 typedef int mapid_t;
@@ -15,6 +16,7 @@ void syscall_halt(void);
 void syscall_exit(int status);
 pid_t syscall_exec(const char *cmd_line, void* esp);
 int syscall_wait(pid_t pid);
+pid_t syscall_fork(struct intr_frame *f);
 bool syscall_create(const char *file, unsigned initial_size);
 bool syscall_remove(const char *file);
 int syscall_open(const char *file);
@@ -32,7 +34,7 @@ void syscall_munmap(mapid_t mapid);
 /* END Lab 3-5 */
 
 // for pinning
-void pin_buffer(void *buffer, int size, void *esp);
+void pin_buffer(void *buffer, int size, void *esp, bool write);
 void unpin_buffer(void *buffer, int size);
 
 void syscall_init (void);
@@ -1,187 +1,829 @@
 #include "vm/frame.h"
 #include "userprog/pagedir.h"
-#include <list.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include "threads/vaddr.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #include "vm/swap.h"
+#include "threads/thread.h"
+#include "threads/interrupt.h"
+#include "devices/timer.h"
 
-struct list frame_table;
+/* Frame table, indexed by user pool page number. */
+static struct frame *frame_table;
+static size_t frame_cnt;
 struct lock frame_lock;
-struct list_elem *frame_clock;
+static size_t frame_clock;
+static size_t frame_used_cnt;
 
-extern struct lock f_lock;
+/* One zeroed kernel page, mapped read-only at every VM_ZERO page
+   that has only been read.  It is not in the user pool, so the
+   clock never sees it; the first write replaces it with a frame
+   of the process's own in frame_break_cow(). */
+static void *zero_page;
+
+/* Page cache: resident read-only file pages, keyed by inode and
+   offset, so that processes running the same executable map
+   one frame for each page of its code instead of reading their
+   own copies.  Protected by frame_lock. */
+static struct hash page_cache;
+static unsigned page_cache_hits, page_cache_misses;
+
+/* Evictions by what the victim cost: dropped, written to swap,
+   written back to its file; and how many were taken from the
+   faulting thread itself, or from a thrashing one, because
+   nothing else was left. */
+static unsigned evict_clean_cnt, evict_swap_cnt, evict_write_cnt, evict_own_cnt;
+static unsigned evict_thrash_cnt;
+
+/* A thread that faulted in this many pages over its last full
+   second is thrashing: taking its frames would only bring it
+   straight back, so the clock leaves them for the later sweeps. */
+#define FAULT_RATE_HIGH 64
+
+/* Out of memory handling: how often, and for how long, a thread
+   that cannot get a frame waits for a killed process to exit
+   before giving up itself. */
+#define OOM_WAITS 8
+#define OOM_WAIT_TICKS 2
+static unsigned oom_kill_cnt;
+
+/* Page-out daemon.  Woken when fewer than pageout_low frames are
+   free, it evicts cold frames until pageout_high are free, so
+   that faults normally find a free frame without writing a
+   victim out themselves. */
+static size_t pageout_low, pageout_high;
+static struct condition pageout_cond;
+static bool pageout_running;
+
+/* Victims being written out by evict_frame() with frame_lock
+   released.  Their swap slots are taken before the lock is let
+   go, so other evictions see them as used.  Their pages
+   are unmapped but still loaded; anyone who needs one waits on
+   evict_cond until it has been written and its frame freed. */
+static size_t evict_in_flight;
+static struct condition evict_cond;
+
+static unsigned page_cache_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct frame *f = hash_entry(e, struct frame, cache_elem);
+    unsigned key[3] = {f->inumber, f->offset, f->read_bytes};
+    return hash_bytes(key, sizeof key);
+}
+
+static bool page_cache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct frame *a = hash_entry(a_, struct frame, cache_elem);
+    const struct frame *b = hash_entry(b_, struct frame, cache_elem);
+    if(a->inumber != b->inumber) {
+        return a->inumber < b->inumber;
+    }
+    if(a->offset != b->offset) {
+        return a->offset < b->offset;
+    }
+    return a->read_bytes < b->read_bytes;
+}
 
 void frame_table_init(void)
 {
-    list_init(&frame_table);
+    frame_cnt = palloc_user_page_cnt();
+    frame_table = calloc(frame_cnt, sizeof *frame_table);
+    if(frame_table == NULL && frame_cnt > 0) {
+        PANIC("frame_table_init: out of memory");
+    }
     lock_init(&frame_lock);
-    frame_clock = NULL;
+    cond_init(&pageout_cond);
+    cond_init(&evict_cond);
+    hash_init(&page_cache, page_cache_hash, page_cache_less, NULL);
+    zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+    frame_clock = 0;
+    frame_used_cnt = 0;
+
+    // keep the watermarks sane for the pool we actually got
+    if(pageout_low == 0) {
+        pageout_low = frame_cnt / 32 + 1;
+    }
+    if(pageout_high <= pageout_low) {
+        pageout_high = pageout_low * 2;
+    }
+    if(pageout_high > frame_cnt / 2) {
+        pageout_high = frame_cnt / 2;
+    }
+    if(pageout_low > pageout_high) {
+        pageout_low = pageout_high;
+    }
 }
 
-void add_frame_to_ft(struct frame *frame)
-{   
-    // add frame in the frame table
-    list_push_back(&frame_table, &frame->frame_table_elem);
+// set by the -lowat and -hiwat kernel command line options
+void frame_set_watermarks(size_t low, size_t high)
+{
+    pageout_low = low;
+    pageout_high = high;
+}
+
+static size_t free_frame_cnt(void)
+{
+    return frame_cnt - frame_used_cnt;
 }
 
-void del_frame_to_ft(struct frame *frame)
-{   
-    // delete frame from the frame table
-    if(frame_clock == &frame->frame_table_elem) {
-        frame_clock = list_remove(frame_clock);
+// true while taking a frame would not wake the page-out daemon,
+// so that speculative loads never push out pages already in use
+bool frame_spare(void)
+{
+    return free_frame_cnt() > pageout_low;
+}
+
+// the shared page that read faults on VM_ZERO pages map
+void *frame_zero_page(void)
+{
+    return zero_page;
+}
+
+static void pageout_daemon(void *aux UNUSED)
+{
+    lock_acquire(&frame_lock);
+    while(true) {
+        cond_wait(&pageout_cond, &frame_lock);
+        while(free_frame_cnt() < pageout_high && evict_frame()) {
+            // let faulting threads at the frame table between batches
+            lock_release(&frame_lock);
+            thread_yield();
+            lock_acquire(&frame_lock);
+        }
+    }
+}
+
+void frame_pageout_init(void)
+{
+    if(frame_cnt == 0) {
+        return;
+    }
+    if(thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL) != TID_ERROR) {
+        pageout_running = true;
+    }
+}
+
+// returns the frame table entry for user pool page KADDR, or NULL
+struct frame *kaddr_to_frame(void *kaddr)
+{
+    size_t idx = palloc_user_page_idx(kaddr);
+    if(idx == SIZE_MAX) {
+        return NULL;
+    }
+    return &frame_table[idx];
+}
+
+static void release_frame(struct frame *f)
+{
+    if(f->cached) {
+        hash_delete(&page_cache, &f->cache_elem);
+    }
+    palloc_free_page(f->phy_addr);
+    memset(f, 0, sizeof *f);
+    frame_used_cnt--;
+}
+
+// true if T will get back to a kill check on its own: it is runnable,
+// or blocked only on frame_lock in the middle of a fault
+static bool can_be_killed(struct thread *t)
+{
+    if(t->status == THREAD_BLOCKED) {
+        return t->waiting_lock == &frame_lock;
+    }
+    return t->status != THREAD_DYING;
+}
+
+// thread_foreach() helper: keeps the user process with the largest resident set
+static void find_largest(struct thread *t, void *largest_)
+{
+    struct thread **largest = largest_;
+    if(t->pagedir != NULL && can_be_killed(t)
+       && (*largest == NULL || t->rss > (*largest)->rss)) {
+        *largest = t;
+    }
+}
+
+/* Called when nothing can be evicted because memory and swap are
+   both full.  Marks the process with the largest resident set to
+   be killed the next time it enters the kernel and waits briefly,
+   without frame_lock, for it to exit.  Processes blocked elsewhere
+   in the kernel, in wait() for instance, are passed over, since
+   they would not see the mark.  Returns false if the running
+   thread should fail its allocation instead: when it is the
+   largest itself, or when it has waited OOM_WAITS times. */
+static bool out_of_memory(int *waits)
+{
+    struct thread *victim = NULL;
+    bool give_up;
+    // the victim cannot exit, and free its thread page, until it is marked
+    enum intr_level old_level = intr_disable();
+    thread_foreach(find_largest, &victim);
+    give_up = victim == NULL || victim == thread_current() || (*waits)++ >= OOM_WAITS;
+    if(give_up) {
+        oom_kill_cnt++;
+    }
+    else if(!victim->oom_killed) {
+        victim->oom_killed = true;
+        oom_kill_cnt++;
     }
-    else {
-        list_remove(&frame->frame_table_elem);
+    intr_set_level(old_level);
+
+    if(give_up) {
+        return false;
     }
+    lock_release(&frame_lock);
+    timer_sleep(OOM_WAIT_TICKS);
+    lock_acquire(&frame_lock);
+    return true;
 }
 
+// returns NULL only when out of memory and the caller's process has to die
 struct frame *allocate_frame(enum palloc_flags flags)
 {
     if((flags & PAL_USER) == 0) {
         return NULL;
     }
-    
-    // allocate and initialize frame
-    struct frame *f = (struct frame *)malloc(sizeof(struct frame));
-    if(!f) {
-        return NULL;
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    void *kaddr = palloc_get_page(flags);
+    int waits = 0;
+    while(!kaddr) {
+        // the daemon fell behind; reclaim in the faulting thread
+        if(!evict_frame()) {
+            if(evict_in_flight > 0) {
+                // frames are on their way out, so memory is not gone yet
+                cond_wait(&evict_cond, &frame_lock);
+            }
+            else if(!out_of_memory(&waits)) {
+                return NULL;
+            }
+        }
+        kaddr = palloc_get_page(flags);
+    }
+    ASSERT(pg_ofs(kaddr) == 0);
+
+    // the frame table slot is fixed by the page's place in the user pool
+    struct frame *f = kaddr_to_frame(kaddr);
+    ASSERT(f != NULL && f->phy_addr == NULL);
+    f->phy_addr = kaddr;
+    list_init(&f->mappings);
+    f->map_cnt = 0;
+    frame_used_cnt++;
+
+    if(pageout_running && free_frame_cnt() < pageout_low) {
+        cond_signal(&pageout_cond, &frame_lock);
     }
-    memset(f, 0, sizeof(struct frame));
-    f->phy_addr = palloc_get_page(flags);
-    while(!(f->phy_addr)) {
-        evict_frame();
-        f->phy_addr = palloc_get_page(flags);
-    }
-    ASSERT(pg_ofs(f->phy_addr) == 0);
-    f->thread = thread_current();
-    
-    // add new frame to frame table
-    add_frame_to_ft(f);
     return f;
 }
 
+// drop every mapping of the frame at KADDR and free it
 void free_frame(void *kaddr)
 {
-    struct frame *f;
+    struct frame *f = kaddr_to_frame(kaddr);
+    if(f == NULL || f->phy_addr == NULL) {
+        return;
+    }
+    while(!list_empty(&f->mappings)) {
+        struct vm_entry *vme = list_entry(list_pop_front(&f->mappings), struct vm_entry, frame_elem);
+        vme->is_loaded = false;
+        vme->thread->rss--;
+        pagedir_clear_page(vme->thread->pagedir, vme->vaddr);
+    }
+    release_frame(f);
+}
+
+// record that VME, of the current thread, now maps F
+void frame_map(struct frame *f, struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    vme->thread = thread_current();
+    vme->thread->rss++;
+    list_push_back(&f->mappings, &vme->frame_elem);
+    f->map_cnt++;
+}
+
+// wait until VME's page is not being written out by evict_frame(); frame_lock must be held
+void frame_wait_evicted(struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    // evict_frame() clears the page table entries before it lets go of the lock
+    while(vme->is_loaded && pagedir_get_page(vme->thread->pagedir, vme->vaddr) == NULL) {
+        cond_wait(&evict_cond, &frame_lock);
+    }
+}
+
+// remove VME's mapping, freeing the frame with its last mapping
+void frame_unmap(struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    frame_wait_evicted(vme);
+    if(!vme->is_loaded) {
+        return;
+    }
+    uint32_t *pd = vme->thread->pagedir;
+    struct frame *f = kaddr_to_frame(pagedir_get_page(pd, vme->vaddr));
+    bool dirty = pagedir_is_dirty(pd, vme->vaddr);
+    vme->is_loaded = false;
+    pagedir_clear_page(pd, vme->vaddr);
+    if(f == NULL || f->phy_addr == NULL) {
+        return;
+    }
+    list_remove(&vme->frame_elem);
+    vme->thread->rss--;
+    if(--f->map_cnt == 0) {
+        release_frame(f);
+    }
+    else if(dirty) {
+        // keep the frame from being dropped as clean when it next gets evicted
+        struct vm_entry *other = list_entry(list_front(&f->mappings), struct vm_entry, frame_elem);
+        pagedir_set_dirty(other->thread->pagedir, other->vaddr, true);
+    }
+}
+
+// map SRC's frame read-only at DST in the current thread, and make SRC
+// read-only too, so that whichever writes first gets its own copy
+bool frame_share(struct vm_entry *src, struct vm_entry *dst)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    uint32_t *src_pd = src->thread->pagedir;
+    uint32_t *dst_pd = thread_current()->pagedir;
+    void *kaddr = pagedir_get_page(src_pd, src->vaddr);
+    struct frame *f = kaddr_to_frame(kaddr);
+    if(f == NULL || f->phy_addr == NULL) {
+        return false;
+    }
+    if(!pagedir_set_page(dst_pd, dst->vaddr, kaddr, false)) {
+        return false;
+    }
+    pagedir_set_dirty(dst_pd, dst->vaddr, pagedir_is_dirty(src_pd, src->vaddr));
+    if(src->writable) {
+        pagedir_set_writable(src_pd, src->vaddr, false);
+    }
+    dst->is_loaded = true;
+    frame_map(f, dst);
+    return true;
+}
+
+// resolve a write fault on VME's read-only copy-on-write mapping
+bool frame_break_cow(struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    uint32_t *pd = vme->thread->pagedir;
+    void *kaddr = pagedir_get_page(pd, vme->vaddr);
+    if(kaddr != NULL && kaddr == zero_page) {
+        // first write to a zero-fill page: give it a frame of its own
+        struct frame *fresh = allocate_frame(PAL_USER | PAL_ZERO);
+        if(fresh == NULL) {
+            return false;
+        }
+        pagedir_clear_page(pd, vme->vaddr);
+        if(!pagedir_set_page(pd, vme->vaddr, fresh->phy_addr, true)) {
+            vme->is_loaded = false;
+            release_frame(fresh);
+            return false;
+        }
+        vme->type = VM_ANON;
+        frame_map(fresh, vme);
+        return true;
+    }
+    struct frame *f = kaddr_to_frame(kaddr);
+    if(f == NULL || f->phy_addr == NULL) {
+        // evicted since the fault; retrying faults it back in
+        return true;
+    }
+    if(f->map_cnt == 1) {
+        // the other mappings are gone, so the page is ours alone
+        pagedir_set_writable(pd, vme->vaddr, true);
+        return true;
+    }
+
+    f->pinned++;
+    struct frame *copy = allocate_frame(PAL_USER);
+    f->pinned--;
+    if(copy == NULL) {
+        return false;
+    }
+    memcpy(copy->phy_addr, kaddr, PGSIZE);
+
+    list_remove(&vme->frame_elem);
+    vme->thread->rss--;
+    f->map_cnt--;
+    pagedir_clear_page(pd, vme->vaddr);
+    // the page table is still there, so this cannot run out of memory
+    if(!pagedir_set_page(pd, vme->vaddr, copy->phy_addr, true)) {
+        vme->is_loaded = false;
+        release_frame(copy);
+        return false;
+    }
+    pagedir_set_dirty(pd, vme->vaddr, true);
+    frame_map(copy, vme);
+    return true;
+}
+
+// only pages nobody can write are safe to hand to other processes
+static bool cacheable(struct vm_entry *vme)
+{
+    return !vme->writable && vme->file != NULL
+        && (vme->type == VM_BIN || vme->type == VM_FILE);
+}
+
+// fill F's page cache key from VME
+static void cache_key(struct frame *f, struct vm_entry *vme)
+{
+    f->inumber = inode_get_inumber(file_get_inode(vme->file));
+    f->offset = vme->offset;
+    f->read_bytes = vme->read_bytes;
+}
+
+// returns the resident frame holding VME's page, or NULL
+struct frame *frame_cache_lookup(struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    if(!cacheable(vme)) {
+        return NULL;
+    }
+    struct frame key;
+    cache_key(&key, vme);
+    struct hash_elem *e = hash_find(&page_cache, &key.cache_elem);
+    if(e == NULL) {
+        page_cache_misses++;
+        return NULL;
+    }
+    page_cache_hits++;
+    return hash_entry(e, struct frame, cache_elem);
+}
+
+// offer F, just loaded for VME, to later lookups
+void frame_cache_insert(struct frame *f, struct vm_entry *vme)
+{
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+    if(!cacheable(vme) || f->cached) {
+        return;
+    }
+    cache_key(f, vme);
+    if(hash_insert(&page_cache, &f->cache_elem) == NULL) {
+        f->cached = true;
+    }
+}
+
+void frame_print_stats(void)
+{
+    printf("Page cache: %u hits, %u misses, %zu pages\n",
+           page_cache_hits, page_cache_misses, hash_size(&page_cache));
+    printf("Eviction: %u clean, %u swapped, %u written back, %u from the faulting thread, "
+           "%u from thrashing threads\n",
+           evict_clean_cnt, evict_swap_cnt, evict_write_cnt, evict_own_cnt, evict_thrash_cnt);
+    printf("Out of memory: %u processes killed\n", oom_kill_cnt);
+}
+
+// true if any mapping of F was accessed since the last call, clearing them all
+static bool frame_accessed(struct frame *f)
+{
+    bool accessed = false;
     struct list_elem *e;
-    // find the frame in the frame table, then free
-    for(e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)) {
-        f = list_entry(e, struct frame, frame_table_elem);
-        if(f->phy_addr == kaddr) {
-            if(f != NULL) {
-                f->frame_mapped_page->is_loaded = false;
-                pagedir_clear_page(f->thread->pagedir, f->frame_mapped_page->vaddr);
-                palloc_free_page(f->phy_addr);
-                del_frame_to_ft(f);
-                free(f);
-            }
-            break;
+    for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+        struct vm_entry *vme = list_entry(e, struct vm_entry, frame_elem);
+        if(pagedir_is_accessed(vme->thread->pagedir, vme->vaddr)) {
+            pagedir_set_accessed(vme->thread->pagedir, vme->vaddr, false);
+            accessed = true;
         }
     }
+    return accessed;
 }
 
-struct frame *get_victim(void)
+// true if any mapping of F was accessed since its bits were last cleared
+static bool frame_recently_accessed(struct frame *f)
 {
-    struct frame *f;
     struct list_elem *e;
-    while(true) {
-        if(!frame_clock || (frame_clock == list_end(&frame_table))) {
-            if(list_empty(&frame_table)) {
-                return NULL;
-            }
-            else{
-                frame_clock = list_begin(&frame_table);
-                e = list_begin(&frame_table);
-            }
+    for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+        struct vm_entry *vme = list_entry(e, struct vm_entry, frame_elem);
+        if(pagedir_is_accessed(vme->thread->pagedir, vme->vaddr)) {
+            return true;
         }
-        else {
-            frame_clock = list_next(frame_clock);
-            if(frame_clock == list_end(&frame_table)) {
-                continue;
-            }
-            e = frame_clock;
+    }
+    return false;
+}
+
+// true if F was written through any of its mappings
+static bool frame_dirty(struct frame *f)
+{
+    struct list_elem *e;
+    for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+        struct vm_entry *vme = list_entry(e, struct vm_entry, frame_elem);
+        if(pagedir_is_dirty(vme->thread->pagedir, vme->vaddr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the mappings of a shared frame all have the same type and backing
+static struct vm_entry *frame_page(struct frame *f)
+{
+    return list_entry(list_front(&f->mappings), struct vm_entry, frame_elem);
+}
+
+// true if evicting F has to write it to swap
+static bool needs_swap(struct frame *f, bool dirty)
+{
+    switch (frame_page(f)->type)
+    {
+    case VM_BIN:
+        return dirty;
+    case VM_ANON:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// true if evicting F has to write it anywhere, to swap or to its file
+static bool needs_write(struct frame *f)
+{
+    bool dirty = frame_dirty(f);
+    return needs_swap(f, dirty) || (frame_page(f)->type == VM_FILE && dirty);
+}
+
+// true if the running thread maps F
+static bool frame_is_own(struct frame *f)
+{
+    struct thread *cur = thread_current();
+    struct list_elem *e;
+    for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+        if(list_entry(e, struct vm_entry, frame_elem)->thread == cur) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// true if a thread mapping F is faulting at FAULT_RATE_HIGH or more
+static bool frame_is_thrashing(struct frame *f)
+{
+    int64_t now = timer_ticks();
+    struct list_elem *e;
+    for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+        struct thread *t = list_entry(e, struct vm_entry, frame_elem)->thread;
+        // a rate from more than a second ago no longer says anything
+        if(t->fault_rate >= FAULT_RATE_HIGH && now - t->fault_window < 2 * TIMER_FREQ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* One sweep of the enhanced clock.  CLEAN_ONLY takes only frames
+   that can be dropped without a write, SPARE_OWN skips frames of
+   the running thread (which is faulting, so its pages are its
+   working set right now), SPARE_THRASHING skips frames of threads
+   faulting at FAULT_RATE_HIGH, and CLEAR clears the accessed bits
+   of the frames it passes over. */
+enum clock_pass
+{
+    PASS_CLEAN_ONLY = 1,
+    PASS_SPARE_OWN = 2,
+    PASS_CLEAR = 4,
+    PASS_SPARE_THRASHING = 8
+};
+
+// advance the clock hand; returns F if it is a victim under PASS
+static struct frame *clock_advance(int pass)
+{
+    frame_clock = (frame_clock + 1) % frame_cnt;
+    struct frame *f = &frame_table[frame_clock];
+    if(f->phy_addr == NULL || f->map_cnt == 0 || f->pinned) {
+        return NULL;
+    }
+    if((pass & PASS_SPARE_OWN) && frame_is_own(f)) {
+        return NULL;
+    }
+    if((pass & PASS_SPARE_THRASHING) && frame_is_thrashing(f)) {
+        return NULL;
+    }
+    if(pass & PASS_CLEAR) {
+        if(frame_accessed(f)) {
+            return NULL;
         }
-        f = list_entry(e, struct frame, frame_table_elem);
-        if(!f->pinned) {
-            if(!pagedir_is_accessed(f->thread->pagedir, f->frame_mapped_page->vaddr)) {
+    }
+    else if(frame_recently_accessed(f)) {
+        return NULL;
+    }
+    if((pass & PASS_CLEAN_ONLY) && needs_write(f)) {
+        return NULL;
+    }
+    return f;
+}
+
+/* Enhanced second-chance clock.  The first sweep looks for a
+   frame that is neither accessed nor in need of a write, the
+   second for any unaccessed frame, clearing accessed bits as it
+   goes, and the pair repeats once with every bit cleared.  Frames
+   of thrashing threads are spared by the first pair, and the
+   running thread's frames are only taken by the last two sweeps.
+   Returns NULL if nothing is evictable. */
+struct frame *get_victim(void)
+{
+    static const int passes[] = {
+        PASS_CLEAN_ONLY | PASS_SPARE_OWN | PASS_SPARE_THRASHING,
+        PASS_CLEAR | PASS_SPARE_OWN | PASS_SPARE_THRASHING,
+        PASS_CLEAN_ONLY | PASS_SPARE_OWN,
+        PASS_CLEAR | PASS_SPARE_OWN,
+        PASS_CLEAR,
+        0,
+    };
+    size_t p, i;
+    if(frame_cnt == 0) {
+        return NULL;
+    }
+    for(p = 0; p < sizeof passes / sizeof *passes; p++) {
+        for(i = 0; i < frame_cnt; i++) {
+            struct frame *f = clock_advance(passes[p]);
+            if(f != NULL) {
+                if(!(passes[p] & PASS_SPARE_OWN) && frame_is_own(f)) {
+                    evict_own_cnt++;
+                }
+                else if(!(passes[p] & PASS_SPARE_THRASHING) && frame_is_thrashing(f)) {
+                    evict_thrash_cnt++;
+                }
                 return f;
             }
-            else {
-                pagedir_set_accessed(f->thread->pagedir, f->frame_mapped_page->vaddr, false);
-            }
         }
     }
+    return NULL;
+}
+
+// returns a frame that can be dropped without a write, ignoring who maps it
+static struct frame *get_clean_victim(void)
+{
+    size_t i;
+    for(i = 0; i < 2 * frame_cnt; i++) {
+        struct frame *f = clock_advance(PASS_CLEAN_ONLY | PASS_CLEAR);
+        if(f != NULL) {
+            return f;
+        }
+    }
+    return NULL;
 }
 
-void evict_frame(void)
+bool evict_frame(void)
 {
+    struct frame *victims[SWAP_BATCH];
+    bool dirty[SWAP_BATCH];
+    void *swap_kaddrs[SWAP_BATCH];
+    size_t swap_slots[SWAP_BATCH];
+    size_t victim_cnt = 0, swap_cnt = 0, i;
+
     struct frame *f = get_victim();
-    bool dirty = pagedir_is_dirty(f->thread->pagedir, f->frame_mapped_page->vaddr);
+    if(f == NULL) {
+        return false;
+    }
+    size_t swap_room = swap_free_cnt();
+    dirty[0] = frame_dirty(f);
+    if(needs_swap(f, dirty[0]) && swap_room == 0) {
+        // swap is full, so only a frame that needs no swap slot will do
+        f = get_clean_victim();
+        if(f == NULL) {
+            return false;
+        }
+        dirty[0] = frame_dirty(f);
+    }
+    victims[victim_cnt++] = f;
 
-    switch (f->frame_mapped_page->type)
-    {
-    case VM_FILE:
-        if(dirty) {
-            lock_acquire(&f_lock);
-            file_write_at(f->frame_mapped_page->file, f->phy_addr, f->frame_mapped_page->read_bytes, f->frame_mapped_page->offset);
-            lock_release(&f_lock);
+    // a victim bound for swap takes more cold swap-bound frames along,
+    // so they go out to adjacent slots in one request
+    if(needs_swap(f, dirty[0])) {
+        f->pinned++;
+        for(i = 0; i < frame_cnt && victim_cnt < SWAP_BATCH && victim_cnt < swap_room; i++) {
+            f = clock_advance(PASS_CLEAR | PASS_SPARE_OWN | PASS_SPARE_THRASHING);
+            if(f == NULL) {
+                continue;
+            }
+            bool d = frame_dirty(f);
+            if(needs_swap(f, d)) {
+                f->pinned++;
+                dirty[victim_cnt] = d;
+                victims[victim_cnt++] = f;
+            }
         }
-        break;
-    case VM_BIN:
-        if(dirty) {
-            f->frame_mapped_page->swap_slot = swap_out(f->phy_addr);
-            f->frame_mapped_page->type = VM_ANON;
+    }
+
+    // take the slots while frame_lock still keeps other evictions out
+    for(i = 0; i < victim_cnt; i++) {
+        if(needs_swap(victims[i], dirty[i])) {
+            swap_kaddrs[swap_cnt++] = victims[i]->phy_addr;
         }
-        break;
-    case VM_ANON:
-        f->frame_mapped_page->swap_slot = swap_out(f->phy_addr);
-        break;
-    default:
-        break;
     }
-    pagedir_clear_page(f->thread->pagedir, f->frame_mapped_page->vaddr);
-    palloc_free_page(f->phy_addr);
-    f->frame_mapped_page->is_loaded = false;
-    del_frame_to_ft(f);
-    free(f);
+    if(swap_cnt > 0 && !swap_alloc_slots(swap_cnt, swap_slots)) {
+        for(i = 0; i < victim_cnt; i++) {
+            if(victims[i]->pinned > 0) {
+                victims[i]->pinned--;
+            }
+        }
+        return false;
+    }
+
+    // unmap first so the owners fault (and wait in frame_wait_evicted())
+    // instead of writing to a page that is being written out
+    size_t write_cnt = 0;
+    for(i = 0; i < victim_cnt; i++) {
+        f = victims[i];
+        struct list_elem *e;
+        for(e = list_begin(&f->mappings); e != list_end(&f->mappings); e = list_next(e)) {
+            struct vm_entry *vme = list_entry(e, struct vm_entry, frame_elem);
+            pagedir_clear_page(vme->thread->pagedir, vme->vaddr);
+        }
+        if(needs_swap(f, dirty[i]) || (frame_page(f)->type == VM_FILE && dirty[i])) {
+            write_cnt++;
+        }
+        if(f->pinned == 0) {
+            f->pinned++;
+        }
+        // nobody may map it from the page cache while it is on its way out
+        if(f->cached) {
+            hash_delete(&page_cache, &f->cache_elem);
+            f->cached = false;
+        }
+    }
+
+    // write without frame_lock, so faults that find a free frame,
+    // and other evictions, need not wait for the disk
+    if(write_cnt > 0) {
+        evict_in_flight += victim_cnt;
+        lock_release(&frame_lock);
+        for(i = 0; i < victim_cnt; i++) {
+            struct vm_entry *page = frame_page(victims[i]);
+            if(page->type == VM_FILE && dirty[i]) {
+                file_write_at(page->file, victims[i]->phy_addr, page->read_bytes, page->offset);
+            }
+        }
+        if(swap_cnt > 0) {
+            swap_write(swap_kaddrs, swap_slots, swap_cnt);
+        }
+        lock_acquire(&frame_lock);
+        evict_in_flight -= victim_cnt;
+    }
+
+    swap_cnt = 0;
+    for(i = 0; i < victim_cnt; i++) {
+        f = victims[i];
+        struct vm_entry *page = frame_page(f);
+        bool swapped = needs_swap(f, dirty[i]);
+        size_t slot = swapped ? swap_slots[swap_cnt++] : 0;
+        if(swapped) {
+            evict_swap_cnt++;
+        }
+        else if(page->type == VM_FILE && dirty[i]) {
+            evict_write_cnt++;
+        }
+        else {
+            evict_clean_cnt++;
+        }
+        // every mapping refers to the one slot, each holding a reference
+        bool first = true;
+        while(!list_empty(&f->mappings)) {
+            struct vm_entry *vme = list_entry(list_pop_front(&f->mappings), struct vm_entry, frame_elem);
+            if(swapped) {
+                if(!first) {
+                    swap_dup(slot);
+                }
+                first = false;
+                vme->swap_slot = slot;
+                vme->type = VM_ANON;
+            }
+            vme->is_loaded = false;
+            vme->thread->rss--;
+        }
+        release_frame(f);
+    }
+    if(write_cnt > 0) {
+        cond_broadcast(&evict_cond, &frame_lock);
+    }
+    return true;
 }
 
 // for pinning
 struct frame* find_frame(void* vaddr)
 {
-    struct list_elem *e;
-	for (e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e))
-	{
-		struct frame *f = list_entry(e, struct frame, frame_table_elem);
-		if ((f->frame_mapped_page->vaddr) == vaddr)
-			return f;
-	}
-	return NULL;
+    return kaddr_to_frame(pagedir_get_page(thread_current()->pagedir, vaddr));
 }
 
 void pin_frame(void *addr)
 {
-    struct list_elem *e;
-    for (e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)) {
-        struct frame *f = list_entry(e, struct frame, frame_table_elem);
-        if ((f->phy_addr) == addr) {
-            f->pinned = true;
-            break;
-        }
+    struct frame *f = kaddr_to_frame(addr);
+    if(f != NULL) {
+        f->pinned++;
     }
 }
 
 void unpin_frame(void *addr)
 {
-	struct list_elem *e;
-    for (e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)) {
-		struct frame *f = list_entry(e, struct frame, frame_table_elem);
-		if ((f->phy_addr) == addr) {
-			f->pinned = false;
-            break;
-		}
-	}
+    struct frame *f = kaddr_to_frame(addr);
+    if(f != NULL && f->pinned > 0) {
+        f->pinned--;
+    }
 }
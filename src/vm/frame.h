@@ -1,31 +1,55 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
+#include <hash.h>
 #include "vm/page.h"
+#include "devices/block.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
-#include <list.h>
 #include "threads/synch.h"
 
+/* One entry per page of the user pool, indexed by its page
+   number within the pool.  A free entry has phy_addr == NULL.
+   A frame is mapped by every vm_entry on its mappings list; more
+   than one means it is shared, either copy-on-write after fork()
+   or as a read-only file page found in the page cache, and each
+   of those mappings is read-only in its page directory. */
 struct frame
 {
-    struct vm_entry *frame_mapped_page;
-    struct thread *thread;
+    struct list mappings;       /* vm_entries, linked by frame_elem. */
+    size_t map_cnt;             /* Length of mappings. */
     void *phy_addr;
-    struct list_elem frame_table_elem;
-	bool pinned;
+    int pinned;                 /* Evictable only when zero. */
+
+    /* Page cache key, for read-only file pages. */
+    bool cached;                /* In the page cache? */
+    block_sector_t inumber;     /* Inode of the backing file. */
+    size_t offset;              /* Offset of the page in it. */
+    size_t read_bytes;          /* Bytes read, the rest zeroed. */
+    struct hash_elem cache_elem;
 };
 
 void frame_table_init(void);
-void add_frame_to_ft(struct frame *frame);
-void del_frame_to_ft(struct frame *frame);
+void frame_set_watermarks(size_t low, size_t high);
+void frame_pageout_init(void);
 struct frame *allocate_frame(enum palloc_flags flags);
+bool frame_spare(void);
+void *frame_zero_page(void);
 void free_frame(void *kaddr);
+void frame_map(struct frame *f, struct vm_entry *vme);
+void frame_wait_evicted(struct vm_entry *vme);
+void frame_unmap(struct vm_entry *vme);
+bool frame_share(struct vm_entry *src, struct vm_entry *dst);
+bool frame_break_cow(struct vm_entry *vme);
+struct frame *frame_cache_lookup(struct vm_entry *vme);
+void frame_cache_insert(struct frame *f, struct vm_entry *vme);
+void frame_print_stats(void);
 
 struct frame *get_victim(void);
-void evict_frame(void);
+bool evict_frame(void);
 
 // for pinning
+struct frame *kaddr_to_frame(void *kaddr);
 struct frame* find_frame(void* vaddr);
 void pin_frame(void *addr);
 void unpin_frame(void *addr);
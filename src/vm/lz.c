@@ -0,0 +1,109 @@
+#include "vm/lz.h"
+#include <debug.h>
+#include <string.h>
+
+// hash of the 3 bytes at P into the work table
+static unsigned hash3(const uint8_t *p)
+{
+    unsigned v = p[0] | p[1] << 8 | p[2] << 16;
+    return (v * 2654435761u) >> 22;
+}
+
+/* Compresses SIZE bytes at SRC into DST, using WORK (LZ_HASH_SIZE
+   entries) as scratch.  Returns the compressed length, or 0 if it
+   would exceed CAP bytes. */
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap, uint16_t *work)
+{
+    size_t in = 0, out = 0, flag_pos = 0;
+    int bit = 8;
+
+    ASSERT(size <= LZ_MAX_OFFSET);
+    // positions are stored plus one, so 0 means none
+    memset(work, 0, LZ_HASH_SIZE * sizeof *work);
+    while(in < size) {
+        if(bit == 8) {
+            if(out >= cap) {
+                return 0;
+            }
+            flag_pos = out++;
+            dst[flag_pos] = 0;
+            bit = 0;
+        }
+
+        // one candidate per hash bucket: the most recent position
+        size_t len = 0, offset = 0;
+        if(in + LZ_MIN_MATCH <= size) {
+            unsigned h = hash3(src + in);
+            size_t cand = work[h];
+            work[h] = in + 1;
+            if(cand != 0) {
+                size_t max = size - in < LZ_MAX_MATCH ? size - in : LZ_MAX_MATCH;
+                cand--;
+                offset = in - cand;
+                while(len < max && src[cand + len] == src[in + len]) {
+                    len++;
+                }
+            }
+        }
+
+        if(len >= LZ_MIN_MATCH) {
+            if(out + 2 > cap) {
+                return 0;
+            }
+            dst[out++] = (offset - 1) & 0xff;
+            dst[out++] = ((offset - 1) >> 8) << 4 | (len - LZ_MIN_MATCH);
+            dst[flag_pos] |= 1 << bit;
+            // let later matches start inside this one
+            for(size_t i = 1; i < len && in + i + LZ_MIN_MATCH <= size; i++) {
+                work[hash3(src + in + i)] = in + i + 1;
+            }
+            in += len;
+        }
+        else {
+            if(out >= cap) {
+                return 0;
+            }
+            dst[out++] = src[in++];
+        }
+        bit++;
+    }
+    return out;
+}
+
+/* Expands LEN compressed bytes at SRC into exactly SIZE bytes at
+   DST.  Returns false if SRC is malformed. */
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    size_t in = 0, out = 0;
+
+    while(out < size) {
+        if(in >= len) {
+            return false;
+        }
+        uint8_t flags = src[in++];
+        for(int bit = 0; bit < 8 && out < size; bit++) {
+            if(flags & (1 << bit)) {
+                if(in + 2 > len) {
+                    return false;
+                }
+                size_t offset = (src[in] | (src[in + 1] >> 4) << 8) + 1;
+                size_t match = (src[in + 1] & 0x0f) + LZ_MIN_MATCH;
+                in += 2;
+                if(offset > out || match > size - out) {
+                    return false;
+                }
+                // byte by byte, since a match may overlap its own output
+                for(size_t i = 0; i < match; i++, out++) {
+                    dst[out] = dst[out - offset];
+                }
+            }
+            else {
+                if(in >= len) {
+                    return false;
+                }
+                dst[out++] = src[in++];
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef VM_LZ_H
+#define VM_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* LZSS compression for pages going to the in-memory swap tier.
+
+   The output is a series of groups, each a flag byte followed by
+   up to eight items, one per flag bit from the least significant
+   up: a 0 bit is a literal byte, a 1 bit a 2-byte back reference
+   holding a 12-bit offset and a 4-bit length.  Inputs are at most
+   LZ_MAX_OFFSET bytes, which covers a page. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 15)
+#define LZ_MAX_OFFSET 4096
+
+/* Entries in the match finder's work table. */
+#define LZ_HASH_SIZE 1024
+
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap, uint16_t *work);
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+
+#endif
@@ -6,88 +6,170 @@
 #include "userprog/pagedir.h"
 #include "threads/vaddr.h"
 #include "filesys/file.h"
-#include <hash.h>
+#include "threads/malloc.h"
+#include <round.h>
 #include <stdlib.h>
+#include <string.h>
 #include <bitmap.h>
 
+// pages in each piece of stack added by vm_stack_page()
+#define STACK_REGION_PAGES 16
+
 extern struct lock frame_lock;
 extern struct lock swap_lock;
 extern struct bitmap *swap_bitmap;
 
-void vm_init(struct hash *vm)
+static uint8_t *region_end(const struct vm_region *r)
 {
-    hash_init(vm, vm_hash_func, vm_less_func, NULL);
+    return r->start + r->page_cnt * PGSIZE;
 }
 
-static unsigned vm_hash_func(const struct hash_elem *e, void *aux)
-{   
-    struct vm_entry *vme = hash_entry(e, struct vm_entry, elem);
-    return hash_int((int)vme->vaddr);
+void vm_init(struct vm_map *vm)
+{
+    list_init(&vm->regions);
+    vm->hint = NULL;
 }
 
-static bool vm_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux)
-{   
-    // return true if a address < b address, otw false
-    void *a_vaddr = hash_entry(a, struct vm_entry, elem)->vaddr;
-    void *b_vaddr = hash_entry(b, struct vm_entry, elem)->vaddr;
-    return (a_vaddr < b_vaddr);
+// the region of VM containing VADDR, or NULL
+static struct vm_region *find_region(struct vm_map *vm, const void *vaddr)
+{
+    const uint8_t *addr = vaddr;
+    struct list_elem *e;
+
+    // faults and syscalls tend to hit the same region over and over
+    if(vm->hint != NULL && addr >= vm->hint->start && addr < region_end(vm->hint)) {
+        return vm->hint;
+    }
+    for(e = list_begin(&vm->regions); e != list_end(&vm->regions); e = list_next(e)) {
+        struct vm_region *r = list_entry(e, struct vm_region, elem);
+        if(addr < r->start) {
+            break;
+        }
+        if(addr < region_end(r)) {
+            vm->hint = r;
+            return r;
+        }
+    }
+    return NULL;
 }
 
-bool insert_vme(struct hash *vm, struct vm_entry *vme)
+// add an empty region of PAGE_CNT pages at START; NULL if it overlaps another or memory runs out
+struct vm_region *vm_add_region(struct vm_map *vm, void *start, size_t page_cnt)
 {
-    if(!hash_insert(vm, &vme->elem)) {
-        return true;
-    } 
-    else {
-        return false;
+    uint8_t *end = (uint8_t *) start + page_cnt * PGSIZE;
+    struct list_elem *e;
+
+    ASSERT(pg_ofs(start) == 0);
+    if(page_cnt == 0 || start == NULL || !is_user_vaddr(end - 1) || end < (uint8_t *) start) {
+        return NULL;
     }
+    for(e = list_begin(&vm->regions); e != list_end(&vm->regions); e = list_next(e)) {
+        struct vm_region *r = list_entry(e, struct vm_region, elem);
+        if(r->start >= end) {
+            break;
+        }
+        if(region_end(r) > (uint8_t *) start) {
+            return NULL;
+        }
+    }
+    struct vm_region *r = calloc(1, sizeof *r + page_cnt * sizeof *r->pages);
+    if(r == NULL) {
+        return NULL;
+    }
+    r->start = start;
+    r->page_cnt = page_cnt;
+    list_insert(e, &r->elem);
+    return r;
 }
 
-bool delete_vme(struct hash *vm, struct vm_entry *vme)
-{   
-    if(hash_delete(vm, &vme->elem)) {
-        lock_acquire(&frame_lock);
-        free_frame(pagedir_get_page(thread_current()->pagedir, vme->vaddr));
-        free(vme);
-        lock_release(&frame_lock);
-        return true;
+// drop VME's frame or swap slot; frame_lock must be held
+static void release_page(struct vm_entry *vme)
+{
+    frame_wait_evicted(vme);
+    if(vme->is_loaded) {
+        frame_unmap(vme);
     }
-    else {
-        return false;
+    else if(vme->type == VM_ANON) {
+        // drop this page's reference to its swap slot
+        swap_free(vme->swap_slot);
     }
 }
 
-struct vm_entry *find_vme(void *vaddr)
+// release every page in R and free it
+void vm_remove_region(struct vm_map *vm, struct vm_region *r)
 {
-    struct vm_entry vme;
-    vme.vaddr = pg_round_down(vaddr);
-    struct hash *vm;
-    vm = &thread_current()->vm;
-    struct hash_elem *e;
-    e = hash_find(vm, &vme.elem);
-    if(e != NULL) {
-        return hash_entry(e, struct vm_entry, elem);
+    lock_acquire(&frame_lock);
+    for(size_t i = 0; i < r->page_cnt; i++) {
+        if(r->pages[i].vaddr != NULL) {
+            release_page(&r->pages[i]);
+        }
     }
-    else {
-        return NULL;
+    lock_release(&frame_lock);
+    list_remove(&r->elem);
+    if(vm->hint == r) {
+        vm->hint = NULL;
     }
+    free(r);
 }
 
-void vm_destroy(struct hash *vm)
+// R's entry for UPAGE, cleared and marked in use; NULL if it already is
+struct vm_entry *vm_claim_page(struct vm_region *r, void *upage)
 {
-    hash_destroy(vm, vm_destroy_func);
+    ASSERT((uint8_t *) upage >= r->start && (uint8_t *) upage < region_end(r));
+    struct vm_entry *vme = &r->pages[((uint8_t *) upage - r->start) / PGSIZE];
+    if(vme->vaddr != NULL) {
+        return NULL;
+    }
+    memset(vme, 0, sizeof *vme);
+    vme->vaddr = pg_round_down(upage);
+    return vme;
 }
 
-static void vm_destroy_func(struct hash_elem *e, void *aux)
+// claim an entry for stack page UPAGE, adding a piece of stack around it if it is in no region yet
+struct vm_entry *vm_stack_page(void *upage)
 {
-    // destroy memory of vm_entry
-    struct vm_entry *vme = hash_entry(e, struct vm_entry, elem);
-    lock_acquire(&frame_lock);
-    if(vme != NULL) {
-        if(vme->is_loaded) {
-            free_frame(pagedir_get_page(thread_current()->pagedir, vme->vaddr));
+    struct vm_map *vm = &thread_current()->vm;
+    struct vm_region *r = find_region(vm, upage);
+    struct list_elem *e;
+
+    if(r == NULL) {
+        // the aligned piece around UPAGE, cut short by its neighbours
+        size_t size = STACK_REGION_PAGES * PGSIZE;
+        uint8_t *start = (uint8_t *) ROUND_DOWN((uintptr_t) upage, size);
+        uint8_t *end = start + size;
+        if(end > (uint8_t *) PHYS_BASE || end < start) {
+            end = PHYS_BASE;
+        }
+        for(e = list_begin(&vm->regions); e != list_end(&vm->regions); e = list_next(e)) {
+            struct vm_region *n = list_entry(e, struct vm_region, elem);
+            if(region_end(n) <= (uint8_t *) upage && region_end(n) > start) {
+                start = region_end(n);
+            }
+            if(n->start > (uint8_t *) upage && n->start < end) {
+                end = n->start;
+            }
+        }
+        r = vm_add_region(vm, start, (end - start) / PGSIZE);
+        if(r == NULL) {
+            return NULL;
         }
-        free(vme);
     }
-    lock_release(&frame_lock);
+    return vm_claim_page(r, upage);
+}
+
+struct vm_entry *find_vme(void *vaddr)
+{
+    struct vm_region *r = find_region(&thread_current()->vm, vaddr);
+    if(r == NULL) {
+        return NULL;
+    }
+    struct vm_entry *vme = &r->pages[((uint8_t *) vaddr - r->start) / PGSIZE];
+    return vme->vaddr != NULL ? vme : NULL;
+}
+
+void vm_destroy(struct vm_map *vm)
+{
+    while(!list_empty(&vm->regions)) {
+        vm_remove_region(vm, list_entry(list_front(&vm->regions), struct vm_region, elem));
+    }
 }
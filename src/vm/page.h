@@ -1,38 +1,58 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
-#include <hash.h>
 #include <list.h>
 #include "filesys/off_t.h"
 
 #define VM_BIN 0
 #define VM_FILE 1
 #define VM_ANON 2
+#define VM_ZERO 3       /* Untouched zero-fill page; see frame_zero_page(). */
 
 /* Lab 3-3 */
 struct vm_entry
 {
     uint8_t type;
-    void *vaddr;
+    void *vaddr;                /* NULL while the entry is unused. */
     bool writable;
     bool is_loaded;
     struct file *file;
     size_t offset;
     size_t read_bytes;
     size_t zero_bytes;
-    struct hash_elem elem;
-    struct list_elem mmap_elem;
     size_t swap_slot;
+    struct thread *thread;      /* Owner, whose pagedir maps vaddr. */
+    struct list_elem frame_elem; /* In the frame's mappings while loaded. */
 };
 
-void vm_init(struct hash *vm);
-static unsigned vm_hash_func(const struct hash_elem *e, void *aux);
-static bool vm_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux);
-bool insert_vme(struct hash *vm, struct vm_entry *vme);
-bool delete_vme(struct hash *vm, struct vm_entry *vme);
+/* A run of adjacent pages set up together: an executable segment,
+   a mapped file or a piece of the stack.  The pages' entries are
+   kept inline, indexed by page number from START, so setting up a
+   segment or a mapping costs one allocation however long it is. */
+struct vm_region
+{
+    uint8_t *start;             /* First page. */
+    size_t page_cnt;
+    int mapid;                  /* Mapping it belongs to, or 0. */
+    struct list_elem elem;      /* In vm_map's regions. */
+    struct vm_entry pages[];
+};
+
+/* A process's supplemental page table: its regions, sorted by
+   address and not overlapping, plus the last one looked up. */
+struct vm_map
+{
+    struct list regions;
+    struct vm_region *hint;
+};
+
+void vm_init(struct vm_map *vm);
+struct vm_region *vm_add_region(struct vm_map *vm, void *start, size_t page_cnt);
+void vm_remove_region(struct vm_map *vm, struct vm_region *r);
+struct vm_entry *vm_claim_page(struct vm_region *r, void *upage);
+struct vm_entry *vm_stack_page(void *upage);
 struct vm_entry *find_vme(void *vaddr);
-static void vm_destroy_func(struct hash_elem *e, void *aux);
-void vm_destroy(struct hash *vm);
+void vm_destroy(struct vm_map *vm);
 
 /* Lab 3-5 */
 struct mmap_file
@@ -40,7 +60,7 @@ struct mmap_file
     int mapid;
     struct file *file;
     struct list_elem elem;
-    struct list vme_list;
+    struct vm_region *region;
 };
 
 #endif
@@ -1,52 +1,448 @@
 #include "vm/swap.h"
 #include <bitmap.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/lz.h"
 #include "threads/synch.h"
+#include "threads/palloc.h"
 #include "devices/block.h"
 #include "threads/vaddr.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 
 #define SECTOR_NUM (PGSIZE/BLOCK_SECTOR_SIZE)
 
+/* swap_lock guards the slot bitmap, reference counts and RAM tier
+   index, and is never held across disk I/O.  swap_write_lock lets
+   one writer at a time use the staging buffers below. */
 struct lock swap_lock;
-struct block *swap_block;
+static struct lock swap_write_lock;
+static struct block *swap_block;
 struct bitmap *swap_bitmap;
+// number of vm_entries referring to each slot; a slot is free once it drops to 0
+static unsigned short *swap_refs;
+
+// slots in use now, and the most ever in use at once
+static size_t swap_used_cnt, swap_peak_cnt;
+
+// next-fit cursor, so consecutive batches land in adjacent slots
+static size_t swap_cursor;
+// contiguous staging area for writing a batch of pages in one request
+static uint8_t *swap_batch_buf;
+
+/* Compressed RAM tier.  A page going out to a swap slot is first
+   compressed into an arena of kernel pages, carved into chunks,
+   and only written to the slot on disk if it does not compress
+   well or, later, when it is the least recently stored page and
+   the arena needs room.  Every page still gets its disk slot, so
+   the slot number stays the page's only name either way. */
+#define ZSWAP_CHUNK 128
+#define ZSWAP_CHUNKS_PER_PAGE (PGSIZE / ZSWAP_CHUNK)
+// pages that compress worse than this go straight to disk
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+struct zslot
+{
+    struct list_elem lru;       // in zswap_lru while in_ram and not demoting
+    uint16_t chunk;             // first arena chunk
+    uint16_t len;               // compressed length
+    bool in_ram;
+    bool demoting;              // being written to its disk slot
+    uint8_t busy;               // readers and demoter using the chunks
+};
+
+// arena pages, set by the -zswap kernel command line option
+static size_t zswap_pages = 32;
+static uint8_t **zswap_arena;
+static struct bitmap *zswap_chunks;
+// one per disk slot
+static struct zslot *zslots;
+// most recently stored first
+static struct list zswap_lru;
+static uint8_t *zswap_buf;
+static uint16_t zswap_work[LZ_HASH_SIZE];
+
+static size_t zswap_stored_cnt;
+static unsigned long long zswap_bytes_in, zswap_bytes_out;
+static unsigned zswap_hits, zswap_misses, zswap_demoted, zswap_rejected;
+
+void swap_set_ram_pages(size_t pages)
+{
+    zswap_pages = pages;
+}
+
+// set up the RAM tier for SLOT_CNT disk slots; leaves it off on failure
+static void zswap_init(size_t slot_cnt)
+{
+    size_t i;
+    list_init(&zswap_lru);
+    // chunk numbers have to fit in a zslot
+    if(zswap_pages > UINT16_MAX / ZSWAP_CHUNKS_PER_PAGE) {
+        zswap_pages = UINT16_MAX / ZSWAP_CHUNKS_PER_PAGE;
+    }
+    if(zswap_pages == 0) {
+        return;
+    }
+    zslots = calloc(slot_cnt, sizeof *zslots);
+    zswap_arena = calloc(zswap_pages, sizeof *zswap_arena);
+    zswap_buf = palloc_get_page(0);
+    if(zslots == NULL || zswap_arena == NULL || zswap_buf == NULL) {
+        goto fail;
+    }
+    for(i = 0; i < zswap_pages; i++) {
+        zswap_arena[i] = palloc_get_page(0);
+        if(zswap_arena[i] == NULL) {
+            break;
+        }
+    }
+    zswap_pages = i;
+    zswap_chunks = bitmap_create(zswap_pages * ZSWAP_CHUNKS_PER_PAGE);
+    if(zswap_pages > 0 && zswap_chunks != NULL) {
+        return;
+    }
+
+fail:
+    if(zswap_arena != NULL) {
+        for(i = 0; i < zswap_pages; i++) {
+            palloc_free_page(zswap_arena[i]);
+        }
+    }
+    free(zswap_arena);
+    free(zslots);
+    palloc_free_page(zswap_buf);
+    zswap_arena = NULL;
+    zslots = NULL;
+    zswap_pages = 0;
+}
+
+static uint8_t *chunk_addr(size_t chunk)
+{
+    return zswap_arena[chunk / ZSWAP_CHUNKS_PER_PAGE] + chunk % ZSWAP_CHUNKS_PER_PAGE * ZSWAP_CHUNK;
+}
+
+// CNT free chunks in a row within one arena page, or BITMAP_ERROR
+static size_t zswap_alloc(size_t cnt)
+{
+    size_t start = 0, chunk;
+    while((chunk = bitmap_scan(zswap_chunks, start, cnt, false)) != BITMAP_ERROR) {
+        if(chunk / ZSWAP_CHUNKS_PER_PAGE == (chunk + cnt - 1) / ZSWAP_CHUNKS_PER_PAGE) {
+            bitmap_set_multiple(zswap_chunks, chunk, cnt, true);
+            return chunk;
+        }
+        start = (chunk / ZSWAP_CHUNKS_PER_PAGE + 1) * ZSWAP_CHUNKS_PER_PAGE;
+    }
+    return BITMAP_ERROR;
+}
+
+// forget Z's compressed copy; swap_lock must be held
+static void zswap_drop(struct zslot *z)
+{
+    bitmap_set_multiple(zswap_chunks, z->chunk, DIV_ROUND_UP(z->len, ZSWAP_CHUNK), false);
+    if(!z->demoting) {
+        list_remove(&z->lru);
+    }
+    z->in_ram = false;
+    z->demoting = false;
+    zswap_stored_cnt--;
+}
+
+// give SLOT back to the free pool; swap_lock must be held
+static void slot_release(size_t slot)
+{
+    bitmap_set(swap_bitmap, slot, false);
+    swap_used_cnt--;
+    if(zslots != NULL && zslots[slot].in_ram) {
+        zswap_drop(&zslots[slot]);
+    }
+}
+
+// done with SLOT's chunks, finishing a demotion or a free put off
+// until nobody was using them; swap_lock must be held
+static void zslot_put(size_t slot)
+{
+    struct zslot *z = &zslots[slot];
+    ASSERT(z->busy > 0);
+    if(--z->busy > 0) {
+        return;
+    }
+    if(swap_refs[slot] == 0) {
+        slot_release(slot);
+    }
+    else if(z->demoting) {
+        // the disk copy is written, so the RAM copy can go
+        zswap_drop(z);
+        zswap_demoted++;
+    }
+}
+
+// make room by writing the least recently stored page to its disk slot;
+// false if there is nothing left to demote.  Called with swap_lock held
+// and swap_write_lock, whose staging buffer it uses; drops swap_lock for
+// the decompression and the write.
+static bool zswap_demote(void)
+{
+    if(list_empty(&zswap_lru)) {
+        return false;
+    }
+    struct zslot *z = list_entry(list_pop_back(&zswap_lru), struct zslot, lru);
+    size_t slot = z - zslots;
+    // readers still find the page in RAM until the write is done, and
+    // busy keeps the chunks, and the slot, from being freed under us
+    z->demoting = true;
+    z->busy++;
+    lock_release(&swap_lock);
+
+    bool ok = lz_decompress(chunk_addr(z->chunk), z->len, swap_batch_buf, PGSIZE);
+    ASSERT(ok);
+    block_write_multiple(swap_block, slot*SECTOR_NUM, swap_batch_buf, SECTOR_NUM);
+
+    lock_acquire(&swap_lock);
+    zslot_put(slot);
+    return true;
+}
+
+// try to keep the page at KADDR for SLOT in the arena, demoting older pages
+// to make room; swap_write_lock must be held, and swap_lock is taken only
+// to update the arena's bookkeeping
+static bool zswap_store(size_t slot, const void *kaddr)
+{
+    if(zslots == NULL) {
+        return false;
+    }
+    size_t len = lz_compress(kaddr, PGSIZE, zswap_buf, ZSWAP_MAX_LEN, zswap_work);
+    lock_acquire(&swap_lock);
+    if(len == 0) {
+        zswap_rejected++;
+        lock_release(&swap_lock);
+        return false;
+    }
+    size_t chunk;
+    while((chunk = zswap_alloc(DIV_ROUND_UP(len, ZSWAP_CHUNK))) == BITMAP_ERROR) {
+        if(!zswap_demote()) {
+            lock_release(&swap_lock);
+            return false;
+        }
+    }
+    lock_release(&swap_lock);
+
+    // the chunks are ours, and nobody looks at SLOT until it is handed out
+    memcpy(chunk_addr(chunk), zswap_buf, len);
+
+    lock_acquire(&swap_lock);
+    struct zslot *z = &zslots[slot];
+    z->chunk = chunk;
+    z->len = len;
+    z->in_ram = true;
+    list_push_front(&zswap_lru, &z->lru);
+    zswap_stored_cnt++;
+    zswap_bytes_in += PGSIZE;
+    zswap_bytes_out += len;
+    lock_release(&swap_lock);
+    return true;
+}
 
 void swap_init(void)
 {
     lock_init(&swap_lock);
+    lock_init(&swap_write_lock);
     swap_block = block_get_role(BLOCK_SWAP);
     if(!swap_block) return;
     swap_bitmap = bitmap_create(block_size(swap_block) / SECTOR_NUM);
     if(!swap_bitmap) return;
+    swap_refs = calloc(bitmap_size(swap_bitmap), sizeof *swap_refs);
+    if(!swap_refs) PANIC("swap_init: out of memory");
+    swap_cursor = 0;
+    swap_batch_buf = palloc_get_multiple(PAL_ASSERT, SWAP_BATCH);
+    zswap_init(bitmap_size(swap_bitmap));
 }
 
-size_t swap_out(void *kaddr)
-{   
-    swap_block = block_get_role(BLOCK_SWAP);
+// allocate CNT adjacent slots, looking past the cursor first
+static size_t swap_alloc(size_t cnt)
+{
+    size_t slot_index = bitmap_scan_and_flip(swap_bitmap, swap_cursor, cnt, false);
+    if(slot_index == BITMAP_ERROR && swap_cursor != 0) {
+        slot_index = bitmap_scan_and_flip(swap_bitmap, 0, cnt, false);
+    }
+    if(slot_index != BITMAP_ERROR) {
+        for(size_t i = 0; i < cnt; i++) {
+            swap_refs[slot_index + i] = 1;
+        }
+        swap_used_cnt += cnt;
+        if(swap_used_cnt > swap_peak_cnt) {
+            swap_peak_cnt = swap_used_cnt;
+        }
+        swap_cursor = slot_index + cnt;
+        if(swap_cursor >= bitmap_size(swap_bitmap)) {
+            swap_cursor = 0;
+        }
+    }
+    return slot_index;
+}
+
+// number of free slots; only eviction takes slots, and it takes them
+// under frame_lock, so a caller holding frame_lock can rely on this many
+size_t swap_free_cnt(void)
+{
+    if(swap_bitmap == NULL) {
+        return 0;
+    }
+    lock_acquire(&swap_lock);
+    size_t cnt = bitmap_size(swap_bitmap) - swap_used_cnt;
+    lock_release(&swap_lock);
+    return cnt;
+}
+
+// take CNT slots into SLOTS, adjacent ones if there is such a run;
+// returns false, taking none, if fewer than CNT are free
+bool swap_alloc_slots(size_t cnt, size_t *slots)
+{
+    size_t i;
+
+    ASSERT(cnt <= SWAP_BATCH);
+    if(swap_bitmap == NULL) {
+        return false;
+    }
     lock_acquire(&swap_lock);
-    size_t slot_index = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
-    if(slot_index == BITMAP_ERROR) {
+    if(bitmap_size(swap_bitmap) - swap_used_cnt < cnt) {
         lock_release(&swap_lock);
-        NOT_REACHED();
-        return BITMAP_ERROR;
+        return false;
     }
-
-    for(int i = 0; i < SECTOR_NUM; i++) {
-        block_write(swap_block, slot_index*SECTOR_NUM + i, kaddr + BLOCK_SECTOR_SIZE*i);
+    size_t slot_index = cnt > 1 ? swap_alloc(cnt) : BITMAP_ERROR;
+    for(i = 0; i < cnt; i++) {
+        slots[i] = slot_index != BITMAP_ERROR ? slot_index + i : swap_alloc(1);
+        ASSERT(slots[i] != BITMAP_ERROR);
     }
     lock_release(&swap_lock);
+    return true;
+}
+
+size_t swap_out(void *kaddr)
+{
+    size_t slot_index;
+    if(!swap_out_multiple(&kaddr, 1, &slot_index)) {
+        return BITMAP_ERROR;
+    }
     return slot_index;
 }
 
+// write CNT pages to swap, storing the slot of KADDRS[i] in SLOTS[i];
+// false if swap has no room for them
+bool swap_out_multiple(void **kaddrs, size_t cnt, size_t *slots)
+{
+    if(!swap_alloc_slots(cnt, slots)) {
+        return false;
+    }
+    swap_write(kaddrs, slots, cnt);
+    return true;
+}
+
+// write CNT pages to the slots SLOTS taken for them by swap_alloc_slots()
+void swap_write(void **kaddrs, const size_t *slots, size_t cnt)
+{
+    bool to_disk[SWAP_BATCH];
+    bool adjacent = true;
+    size_t disk_cnt = 0, i;
+
+    ASSERT(cnt <= SWAP_BATCH);
+    lock_acquire(&swap_write_lock);
+    // the RAM tier takes what it can; the rest goes to disk.  Nobody
+    // reads these slots before the caller hands them out, so the writes
+    // need only the staging buffer, not swap_lock
+    for(i = 0; i < cnt; i++) {
+        to_disk[i] = !zswap_store(slots[i], kaddrs[i]);
+        disk_cnt += to_disk[i];
+        adjacent = adjacent && slots[i] == slots[0] + i;
+    }
+    if(cnt > 1 && adjacent && disk_cnt == cnt) {
+        // one run of adjacent slots: a single multi-sector write
+        for(i = 0; i < cnt; i++) {
+            memcpy(swap_batch_buf + PGSIZE*i, kaddrs[i], PGSIZE);
+        }
+        block_write_multiple(swap_block, slots[0]*SECTOR_NUM, swap_batch_buf, cnt*SECTOR_NUM);
+    }
+    else {
+        for(i = 0; i < cnt; i++) {
+            if(to_disk[i]) {
+                block_write_multiple(swap_block, slots[i]*SECTOR_NUM, kaddrs[i], SECTOR_NUM);
+            }
+        }
+    }
+    lock_release(&swap_write_lock);
+}
+
+// drop one reference to SLOT, freeing it with the last; swap_lock must be held
+static void swap_unref(size_t slot)
+{
+    ASSERT(swap_refs[slot] > 0);
+    // a slot whose chunks are in use is released by zslot_put()
+    if(--swap_refs[slot] == 0 && (zslots == NULL || zslots[slot].busy == 0)) {
+        slot_release(slot);
+    }
+}
+
+// read SLOT into KADDR, dropping the caller's reference to it
 bool swap_in(size_t used_index, void *kaddr)
 {
-    swap_block = block_get_role(BLOCK_SWAP);
     lock_acquire(&swap_lock);
-    for(int i = 0; i < SECTOR_NUM; i++) {
-        block_read(swap_block, used_index*SECTOR_NUM + i, kaddr + BLOCK_SECTOR_SIZE*i);
+    if(zslots != NULL && zslots[used_index].in_ram) {
+        // busy keeps the chunks from being freed or demoted away meanwhile
+        struct zslot *z = &zslots[used_index];
+        size_t chunk = z->chunk, len = z->len;
+        z->busy++;
+        zswap_hits++;
+        lock_release(&swap_lock);
+
+        bool ok = lz_decompress(chunk_addr(chunk), len, kaddr, PGSIZE);
+        ASSERT(ok);
+
+        lock_acquire(&swap_lock);
+        zslot_put(used_index);
+        swap_unref(used_index);
+        lock_release(&swap_lock);
+        return true;
     }
-    bitmap_set(swap_bitmap, used_index, false);
+    zswap_misses++;
+    lock_release(&swap_lock);
+
+    // the caller's reference keeps the slot from being freed and reused meanwhile
+    block_read_multiple(swap_block, used_index*SECTOR_NUM, kaddr, SECTOR_NUM);
+    lock_acquire(&swap_lock);
+    swap_unref(used_index);
     lock_release(&swap_lock);
     return true;
 }
 
+// add a reference to SLOT, for a page that another vm_entry shares
+void swap_dup(size_t slot)
+{
+    lock_acquire(&swap_lock);
+    ASSERT(swap_refs[slot] > 0);
+    swap_refs[slot]++;
+    lock_release(&swap_lock);
+}
+
+// drop a reference to SLOT without reading it
+void swap_free(size_t slot)
+{
+    lock_acquire(&swap_lock);
+    swap_unref(slot);
+    lock_release(&swap_lock);
+}
+
+void swap_print_stats(void)
+{
+    if(swap_bitmap == NULL) {
+        return;
+    }
+    printf("Swap: %zu of %zu slots in use, at most %zu\n",
+           swap_used_cnt, bitmap_size(swap_bitmap), swap_peak_cnt);
+    if(zslots != NULL) {
+        unsigned ratio = zswap_bytes_out ? zswap_bytes_in * 100 / zswap_bytes_out : 0;
+        printf("Swap RAM tier: %zu pages held in %zu, ratio %u.%02u, "
+               "%u reads from RAM, %u from disk, %u demoted, %u incompressible\n",
+               zswap_stored_cnt, zswap_pages, ratio / 100, ratio % 100,
+               zswap_hits, zswap_misses, zswap_demoted, zswap_rejected);
+    }
+}
@@ -4,8 +4,19 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+/* Maximum number of pages written to swap by one request. */
+#define SWAP_BATCH 4
+
+void swap_set_ram_pages(size_t pages);
 void swap_init(void);
 size_t swap_out(void *kaddr);
+bool swap_out_multiple(void **kaddrs, size_t cnt, size_t *slots);
+bool swap_alloc_slots(size_t cnt, size_t *slots);
+void swap_write(void **kaddrs, const size_t *slots, size_t cnt);
 bool swap_in(size_t used_index, void *kaddr);
+void swap_dup(size_t slot);
+void swap_free(size_t slot);
+size_t swap_free_cnt(void);
+void swap_print_stats(void);
 
 #endif